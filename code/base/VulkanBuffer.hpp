@@ -14,6 +14,7 @@
 
 #include "vulkan/vulkan.h"
 #include "VulkanTools.h"
+#include "VulkanMemoryAllocator.hpp"
 
 namespace vks
 {	
@@ -23,14 +24,19 @@ namespace vks
 	*/
 	struct Buffer
 	{
-		VkBuffer buffer;
+		VkBuffer buffer = VK_NULL_HANDLE;
 		VkDevice device;
-		VkDeviceMemory memory;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
 		VkDescriptorBufferInfo descriptor;
 		VkDeviceSize size = 0;
 		VkDeviceSize alignment = 0;
 		void* mapped = nullptr;
 
+		/** @brief Allocator the memory has been sub-allocated from, null if the buffer owns its memory */
+		vks::MemoryAllocator* allocator = nullptr;
+		/** @brief Range of memory bound to this buffer if it has been sub-allocated */
+		vks::Allocation allocation;
+
 		/** @brief Usage flags to be filled by external source at buffer creation (to query at some later point) */
 		VkBufferUsageFlags usageFlags;
 		/** @brief Memory propertys flags to be filled by external source at buffer creation (to query at some later point) */
@@ -46,6 +52,16 @@ namespace vks
 		*/
 		VkResult map(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0)
 		{
+			if (allocator)
+			{
+				// Sub-allocated host visible memory is persistently mapped by the allocator
+				if (!allocation.mapped)
+				{
+					return VK_ERROR_MEMORY_MAP_FAILED;
+				}
+				mapped = static_cast<char*>(allocation.mapped) + offset;
+				return VK_SUCCESS;
+			}
 			return vkMapMemory(device, memory, offset, size, 0, &mapped);
 		}
 
@@ -58,7 +74,10 @@ namespace vks
 		{
 			if (mapped)
 			{
-				vkUnmapMemory(device, memory);
+				if (!allocator)
+				{
+					vkUnmapMemory(device, memory);
+				}
 				mapped = nullptr;
 			}
 		}
@@ -72,7 +91,7 @@ namespace vks
 		*/
 		VkResult bind(VkDeviceSize offset = 0)
 		{
-			return vkBindBufferMemory(device, buffer, memory, offset);
+			return vkBindBufferMemory(device, buffer, memory, allocation.offset + offset);
 		}
 
 		/**
@@ -117,8 +136,8 @@ namespace vks
 			VkMappedMemoryRange mappedRange = {};
 			mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
 			mappedRange.memory = memory;
-			mappedRange.offset = offset;
-			mappedRange.size = size;
+			mappedRange.offset = allocation.offset + offset;
+			mappedRange.size = ((size == VK_WHOLE_SIZE) && allocator) ? allocation.size - offset : size;
 			return vkFlushMappedMemoryRanges(device, 1, &mappedRange);
 		}
 
@@ -137,8 +156,8 @@ namespace vks
 			VkMappedMemoryRange mappedRange = {};
 			mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
 			mappedRange.memory = memory;
-			mappedRange.offset = offset;
-			mappedRange.size = size;
+			mappedRange.offset = allocation.offset + offset;
+			mappedRange.size = ((size == VK_WHOLE_SIZE) && allocator) ? allocation.size - offset : size;
 			return vkInvalidateMappedMemoryRanges(device, 1, &mappedRange);
 		}
 
@@ -150,11 +169,19 @@ namespace vks
 			if (buffer)
 			{
 				vkDestroyBuffer(device, buffer, nullptr);
+				buffer = VK_NULL_HANDLE;
+			}
+			if (allocator)
+			{
+				allocator->free(&allocation);
+				allocator = nullptr;
 			}
-			if (memory)
+			else if (memory)
 			{
 				vkFreeMemory(device, memory, nullptr);
 			}
+			memory = VK_NULL_HANDLE;
+			mapped = nullptr;
 		}
 
 	};
@@ -0,0 +1,297 @@
+/*
+* Vulkan call accounting
+*
+* Counts the calls made through a device dispatch table and accumulates their CPU time per frame,
+* calls that are too expensive for the frame loop (allocations, waits for idle) are flagged
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanDeviceDispatch.hpp"
+
+namespace vks
+{
+	/** @brief Index of an entry point of the device dispatch table */
+	enum DeviceCall
+	{
+#define VKS_DEVICE_CALL_ENUM(name) DEVICE_CALL_##name,
+		VKS_DEVICE_DISPATCH_FUNCTIONS(VKS_DEVICE_CALL_ENUM)
+		VKS_DEVICE_DISPATCH_EXPENSIVE_FUNCTIONS(VKS_DEVICE_CALL_ENUM)
+#undef VKS_DEVICE_CALL_ENUM
+		DEVICE_CALL_COUNT
+	};
+
+	/** @brief Number of calls of an entry point and the CPU time spent in them */
+	struct CallStats
+	{
+		uint32_t count = 0;
+		uint64_t nanoseconds = 0;
+	};
+
+	/**
+	* @brief Interception layer over a device dispatch table
+	*
+	* While enabled, the entries of the dispatch table are replaced with thunks that time the call and forward it
+	* to the original function pointer. Disabling restores the original pointers, so there is no overhead left.
+	* The counters are atomic since command buffers are recorded on several threads.
+	*
+	* The render loop calls beginFrame before and endFrame after each frame, calls made between two frames (e.g. overlay
+	* updates) count towards the next one. The table is only intercepted from within the frame loop, so any expensive
+	* call that shows up is logged.
+	*
+	* @note Only one instance can be enabled at a time (the thunks are shared)
+	*/
+	class CallAccounting
+	{
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		struct Counter
+		{
+			std::atomic<uint32_t> count;
+			std::atomic<uint64_t> nanoseconds;
+		};
+
+		/** @brief Original entry points of the intercepted dispatch table */
+		PFN_vkVoidFunction next[DEVICE_CALL_COUNT] = {};
+		/** @brief Calls made since the last endFrame */
+		Counter counters[DEVICE_CALL_COUNT];
+		/** @brief Frames (since enabling) in which each entry point was called */
+		uint32_t callFrames[DEVICE_CALL_COUNT] = {};
+		DeviceDispatch *installed = nullptr;
+		bool requested = false;
+		uint32_t frames = 0;
+
+		static CallAccounting *&active()
+		{
+			static CallAccounting *accounting = nullptr;
+			return accounting;
+		}
+
+		/** @brief Adds the time until the end of its scope to a counter */
+		struct Scope
+		{
+			Counter &counter;
+			Clock::time_point start;
+			Scope(Counter &counter) : counter(counter), start(Clock::now()) {}
+			~Scope()
+			{
+				uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+				counter.count.fetch_add(1, std::memory_order_relaxed);
+				counter.nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+			}
+		};
+
+		template<DeviceCall call, typename Function> struct Thunk;
+
+		template<DeviceCall call, typename Result, typename... Args>
+		struct Thunk<call, Result (VKAPI_PTR *)(Args...)>
+		{
+			static VKAPI_ATTR Result VKAPI_CALL intercept(Args... args)
+			{
+				CallAccounting *accounting = active();
+				Scope scope(accounting->counters[call]);
+				return reinterpret_cast<Result (VKAPI_PTR *)(Args...)>(accounting->next[call])(args...);
+			}
+		};
+
+		static bool expensive(uint32_t call)
+		{
+			return call >= DEVICE_CALL_AllocateMemory;
+		}
+
+		void install(DeviceDispatch &dispatch)
+		{
+			if (active() != nullptr)
+			{
+				LOGW("Call accounting is already enabled for another dispatch table");
+				return;
+			}
+			active() = this;
+			resetCounters();
+#define VKS_CALL_ACCOUNTING_INSTALL(name)																\
+			next[DEVICE_CALL_##name] = reinterpret_cast<PFN_vkVoidFunction>(dispatch.name);				\
+			dispatch.name = &Thunk<DEVICE_CALL_##name, PFN_vk##name>::intercept;
+			VKS_DEVICE_DISPATCH_FUNCTIONS(VKS_CALL_ACCOUNTING_INSTALL)
+			VKS_DEVICE_DISPATCH_EXPENSIVE_FUNCTIONS(VKS_CALL_ACCOUNTING_INSTALL)
+#undef VKS_CALL_ACCOUNTING_INSTALL
+			installed = &dispatch;
+		}
+
+		void uninstall()
+		{
+#define VKS_CALL_ACCOUNTING_UNINSTALL(name)																\
+			installed->name = reinterpret_cast<PFN_vk##name>(next[DEVICE_CALL_##name]);
+			VKS_DEVICE_DISPATCH_FUNCTIONS(VKS_CALL_ACCOUNTING_UNINSTALL)
+			VKS_DEVICE_DISPATCH_EXPENSIVE_FUNCTIONS(VKS_CALL_ACCOUNTING_UNINSTALL)
+#undef VKS_CALL_ACCOUNTING_UNINSTALL
+			installed = nullptr;
+			active() = nullptr;
+		}
+
+		void resetCounters()
+		{
+			for (uint32_t i = 0; i < DEVICE_CALL_COUNT; i++)
+			{
+				counters[i].count = 0;
+				counters[i].nanoseconds = 0;
+				callFrames[i] = 0;
+				lastFrame[i] = CallStats();
+			}
+			frames = 0;
+		}
+
+	public:
+		/** @brief Calls of the last finished frame, per entry point */
+		CallStats lastFrame[DEVICE_CALL_COUNT];
+
+		/** @brief Name of an entry point (without the vk prefix) */
+		static const char *name(uint32_t call)
+		{
+			static const char *names[DEVICE_CALL_COUNT] = {
+#define VKS_DEVICE_CALL_NAME(name) #name,
+				VKS_DEVICE_DISPATCH_FUNCTIONS(VKS_DEVICE_CALL_NAME)
+				VKS_DEVICE_DISPATCH_EXPENSIVE_FUNCTIONS(VKS_DEVICE_CALL_NAME)
+#undef VKS_DEVICE_CALL_NAME
+			};
+			return names[call];
+		}
+
+		CallAccounting()
+		{
+			for (uint32_t i = 0; i < DEVICE_CALL_COUNT; i++)
+			{
+				counters[i].count = 0;
+				counters[i].nanoseconds = 0;
+			}
+		}
+
+		/** @note Doesn't touch the dispatch table, which may have been destroyed with its device already */
+		~CallAccounting()
+		{
+			if (installed)
+			{
+				active() = nullptr;
+			}
+		}
+
+		/**
+		* Request the accounting to be switched on or off
+		*
+		* @note Takes effect with the next beginFrame, so the table is never swapped while command buffers are recorded
+		*/
+		void setEnabled(bool enabled)
+		{
+			requested = enabled;
+		}
+
+		bool enabled() const
+		{
+			return installed != nullptr;
+		}
+
+		/** @brief Start a frame of the render loop, applies a pending toggle */
+		void beginFrame(DeviceDispatch &dispatch)
+		{
+			if (requested && !installed)
+			{
+				install(dispatch);
+				LOGD("Vulkan call accounting enabled");
+			}
+			else if (!requested && installed)
+			{
+				uninstall();
+				LOGD("Vulkan call accounting disabled");
+			}
+		}
+
+		/** @brief Finish a frame, moves the calls since the last frame to lastFrame and flags expensive ones */
+		void endFrame()
+		{
+			if (!installed)
+			{
+				return;
+			}
+			frames++;
+			for (uint32_t i = 0; i < DEVICE_CALL_COUNT; i++)
+			{
+				lastFrame[i].count = counters[i].count.exchange(0, std::memory_order_relaxed);
+				lastFrame[i].nanoseconds = counters[i].nanoseconds.exchange(0, std::memory_order_relaxed);
+				if (lastFrame[i].count == 0)
+				{
+					continue;
+				}
+				callFrames[i]++;
+				// Log the first frames with an expensive call, it keeps showing up in the summary afterwards
+				if (expensive(i) && (callFrames[i] <= 3))
+				{
+					LOGW("vk%s called %u times (%.3f ms) inside the frame loop (frame %u)", name(i), lastFrame[i].count, lastFrame[i].nanoseconds / 1000000.0, frames);
+				}
+			}
+		}
+
+		/** @brief Total of all calls of the last frame */
+		CallStats frameTotal() const
+		{
+			CallStats total;
+			for (uint32_t i = 0; i < DEVICE_CALL_COUNT; i++)
+			{
+				total.count += lastFrame[i].count;
+				total.nanoseconds += lastFrame[i].nanoseconds;
+			}
+			return total;
+		}
+
+		/**
+		* Summary of the last frame, e.g. for the text overlay or the log
+		*
+		* @param topCount Number of entry points with the most CPU time to list
+		*/
+		std::string getSummary(uint32_t topCount = 3) const
+		{
+			if (!installed)
+			{
+				return "vk calls: off";
+			}
+			CallStats total = frameTotal();
+			std::stringstream ss;
+			ss << std::fixed << std::setprecision(3) << "vk calls: " << total.count << " (" << total.nanoseconds / 1000000.0 << "ms)";
+
+			std::vector<uint32_t> calls;
+			for (uint32_t i = 0; i < DEVICE_CALL_COUNT; i++)
+			{
+				if (lastFrame[i].count > 0)
+				{
+					calls.push_back(i);
+				}
+			}
+			std::sort(calls.begin(), calls.end(), [this](uint32_t a, uint32_t b) { return lastFrame[a].nanoseconds > lastFrame[b].nanoseconds; });
+			for (uint32_t i = 0; i < std::min(topCount, static_cast<uint32_t>(calls.size())); i++)
+			{
+				ss << " " << name(calls[i]) << " " << lastFrame[calls[i]].count << "x " << lastFrame[calls[i]].nanoseconds / 1000000.0 << "ms";
+			}
+
+			// Expensive entry points called in any frame since enabling
+			for (uint32_t i = DEVICE_CALL_AllocateMemory; i < DEVICE_CALL_COUNT; i++)
+			{
+				if (callFrames[i] > 0)
+				{
+					ss << " !" << name(i) << " in " << callFrames[i] << "/" << frames << " frames";
+				}
+			}
+			return ss.str();
+		}
+	};
+}
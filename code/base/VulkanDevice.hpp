@@ -16,6 +16,7 @@
 #include "vulkan/vulkan.h"
 #include "VulkanTools.h"
 #include "VulkanBuffer.hpp"
+#include "VulkanDeviceDispatch.hpp"
 
 namespace vks
 {	
@@ -39,9 +40,20 @@ namespace vks
 		/** @brief Default command pool for the graphics queue family index */
 		VkCommandPool commandPool = VK_NULL_HANDLE;
 
+		/** @brief Set to true if a memory type is both device local and host visible (unified memory, e.g. mobile GPUs) */
+		bool unifiedMemory = false;
+		/** @brief Property flags of the unified memory type, to be used for buffers the host writes and the device reads without a staging copy */
+		VkMemoryPropertyFlags unifiedMemoryPropertyFlags = 0;
+
+		/** @brief Sub-allocator used for buffer and image memory, created along with the logical device */
+		vks::MemoryAllocator *memoryAllocator = nullptr;
+
 		/** @brief Set to true when the debug marker extension is detected */
 		bool enableDebugMarkers = false;
 
+		/** @brief Device level function pointers (loaded along with the logical device), used by the per frame paths */
+		vks::DeviceDispatch dispatch;
+
 		/** @brief Contains queue family indices */
 		struct
 		{
@@ -70,6 +82,20 @@ namespace vks
 			vkGetPhysicalDeviceFeatures(physicalDevice, &features);
 			// Memory properties are used regularly for creating all kinds of buffers
 			vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+			// Detect memory that can be written by the host and read by the device at full speed, coherent memory is preferred
+			const VkMemoryPropertyFlags unifiedFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+			for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+			{
+				VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[i].propertyFlags;
+				if ((flags & unifiedFlags) == unifiedFlags)
+				{
+					if (!unifiedMemory || (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+					{
+						unifiedMemoryPropertyFlags = unifiedFlags | (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+					}
+					unifiedMemory = true;
+				}
+			}
 			// Queue family properties, used for setting up requested queues upon device creation
 			uint32_t queueFamilyCount;
 			vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
@@ -104,6 +130,10 @@ namespace vks
 			{
 				vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
 			}
+			if (memoryAllocator)
+			{
+				delete memoryAllocator;
+			}
 			if (logicalDevice)
 			{
 				vkDestroyDevice(logicalDevice, nullptr);
@@ -327,8 +357,10 @@ namespace vks
 
 			if (result == VK_SUCCESS)
 			{
+				dispatch.load(logicalDevice);
 				// Create a default command pool for graphics command buffers
 				commandPool = createCommandPool(queueFamilyIndices.graphics);
+				memoryAllocator = new vks::MemoryAllocator(logicalDevice, &dispatch, memoryProperties, properties.limits);
 			}
 
 			return result;
@@ -344,6 +376,8 @@ namespace vks
 		* @param memory Pointer to the memory handle acquired by the function
 		* @param data Pointer to the data that should be copied to the buffer after creation (optional, if not set, no data is copied over)
 		*
+		* @note The memory is a dedicated allocation owned by the caller, prefer the vks::Buffer overload which sub-allocates
+		*
 		* @return VK_SUCCESS if buffer handle and memory have been created and (optionally passed) data has been copied
 		*/
 		VkResult createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize size, VkBuffer *buffer, VkDeviceMemory *memory, void *data = nullptr)
@@ -351,7 +385,7 @@ namespace vks
 			// Create the buffer handle
 			VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(usageFlags, size);
 			bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-			VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, buffer));
+			VK_CHECK_RESULT(dispatch.CreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, buffer));
 
 			// Create the memory backing up the buffer handle
 			VkMemoryRequirements memReqs;
@@ -360,7 +394,7 @@ namespace vks
 			memAlloc.allocationSize = memReqs.size;
 			// Find a memory type index that fits the properties of the buffer
 			memAlloc.memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
-			VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, memory));
+			VK_CHECK_RESULT(dispatch.AllocateMemory(logicalDevice, &memAlloc, nullptr, memory));
 			
 			// If a pointer to the buffer data has been passed, map the buffer and copy over the data
 			if (data != nullptr)
@@ -394,28 +428,39 @@ namespace vks
 		* @param buffer Pointer to a vk::Vulkan buffer object
 		* @param size Size of the buffer in byes
 		* @param data Pointer to the data that should be copied to the buffer after creation (optional, if not set, no data is copied over)
+		* @param strategy (Optional) Sub-allocation strategy, use ALLOCATION_STRATEGY_LINEAR for short lived buffers (Defaults to ALLOCATION_STRATEGY_FREE_LIST)
 		*
-		* @return VK_SUCCESS if buffer handle and memory have been created and (optionally passed) data has been copied
+		* @note The memory is sub-allocated from the device's memoryAllocator and released by vks::Buffer::destroy
+		*
+		* @return VK_SUCCESS if buffer handle and memory have been created and (optionally passed) data has been copied, VK_ERROR_FEATURE_NOT_PRESENT if no memory type of the buffer has the requested properties
 		*/
-		VkResult createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, vks::Buffer *buffer, VkDeviceSize size, void *data = nullptr)
+		VkResult createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, vks::Buffer *buffer, VkDeviceSize size, void *data = nullptr, vks::AllocationStrategy strategy = vks::ALLOCATION_STRATEGY_FREE_LIST)
 		{
 			buffer->device = logicalDevice;
 
 			// Create the buffer handle
 			VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(usageFlags, size);
-			VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, &buffer->buffer));
+			VK_CHECK_RESULT(dispatch.CreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, &buffer->buffer));
 
-			// Create the memory backing up the buffer handle
+			// Sub-allocate the memory backing up the buffer handle
 			VkMemoryRequirements memReqs;
-			VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
 			vkGetBufferMemoryRequirements(logicalDevice, buffer->buffer, &memReqs);
-			memAlloc.allocationSize = memReqs.size;
 			// Find a memory type index that fits the properties of the buffer
-			memAlloc.memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
-			VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, &buffer->memory));
+			VkBool32 memoryTypeFound = VK_FALSE;
+			uint32_t memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags, &memoryTypeFound);
+			if (!memoryTypeFound)
+			{
+				// Let the caller fall back to other memory properties
+				dispatch.DestroyBuffer(logicalDevice, buffer->buffer, nullptr);
+				buffer->buffer = VK_NULL_HANDLE;
+				return VK_ERROR_FEATURE_NOT_PRESENT;
+			}
+			VK_CHECK_RESULT(memoryAllocator->allocate(memReqs, memoryTypeIndex, vks::ALLOCATION_KIND_LINEAR, strategy, &buffer->allocation));
+			buffer->allocator = memoryAllocator;
+			buffer->memory = buffer->allocation.memory;
 
 			buffer->alignment = memReqs.alignment;
-			buffer->size = memAlloc.allocationSize;
+			buffer->size = memReqs.size;
 			buffer->usageFlags = usageFlags;
 			buffer->memoryPropertyFlags = memoryPropertyFlags;
 
@@ -424,6 +469,11 @@ namespace vks
 			{
 				VK_CHECK_RESULT(buffer->map());
 				memcpy(buffer->mapped, data, size);
+				// If host coherency hasn't been requested, do a manual flush to make writes visible
+				if ((memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0)
+				{
+					buffer->flush();
+				}
 				buffer->unmap();
 			}
 
@@ -434,6 +484,29 @@ namespace vks
 			return buffer->bind();
 		}
 
+		/**
+		* Sub-allocate memory for an image and bind it
+		*
+		* @param image Image to allocate the memory for
+		* @param memoryPropertyFlags Memory properties for the image memory (i.e. device local, host visible)
+		* @param allocation Pointer to the allocation that receives the memory range, to be released with memoryAllocator->free
+		* @param (Optional) linearTiling Set to true for images created with VK_IMAGE_TILING_LINEAR (Defaults to false)
+		*
+		* @return VkResult of the memory binding call
+		*/
+		VkResult allocateImageMemory(VkImage image, VkMemoryPropertyFlags memoryPropertyFlags, vks::Allocation *allocation, bool linearTiling = false)
+		{
+			VkMemoryRequirements memReqs;
+			vkGetImageMemoryRequirements(logicalDevice, image, &memReqs);
+			uint32_t memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
+			VkResult result = memoryAllocator->allocate(memReqs, memoryTypeIndex, linearTiling ? vks::ALLOCATION_KIND_LINEAR : vks::ALLOCATION_KIND_OPTIMAL, vks::ALLOCATION_STRATEGY_FREE_LIST, allocation);
+			if (result != VK_SUCCESS)
+			{
+				return result;
+			}
+			return vkBindImageMemory(logicalDevice, image, allocation->memory, allocation->offset);
+		}
+
 		/**
 		* Copy buffer data from src to dst using VkCmdCopyBuffer
 		* 
@@ -504,7 +577,7 @@ namespace vks
 			if (begin)
 			{
 				VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
-				VK_CHECK_RESULT(vkBeginCommandBuffer(cmdBuffer, &cmdBufInfo));
+				VK_CHECK_RESULT(dispatch.BeginCommandBuffer(cmdBuffer, &cmdBufInfo));
 			}
 
 			return cmdBuffer;
@@ -527,7 +600,7 @@ namespace vks
 				return;
 			}
 
-			VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+			VK_CHECK_RESULT(dispatch.EndCommandBuffer(commandBuffer));
 
 			VkSubmitInfo submitInfo = vks::initializers::submitInfo();
 			submitInfo.commandBufferCount = 1;
@@ -539,9 +612,9 @@ namespace vks
 			VK_CHECK_RESULT(vkCreateFence(logicalDevice, &fenceInfo, nullptr, &fence));
 			
 			// Submit to the queue
-			VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
+			VK_CHECK_RESULT(dispatch.QueueSubmit(queue, 1, &submitInfo, fence));
 			// Wait for the fence to signal that command buffer has finished executing
-			VK_CHECK_RESULT(vkWaitForFences(logicalDevice, 1, &fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
+			VK_CHECK_RESULT(dispatch.WaitForFences(logicalDevice, 1, &fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
 
 			vkDestroyFence(logicalDevice, fence, nullptr);
 
@@ -0,0 +1,90 @@
+/*
+* Vulkan device dispatch table
+*
+* Device level function pointers resolved with vkGetDeviceProcAddr, calls through them go straight
+* to the driver instead of through the loader's dispatch trampolines
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <assert.h>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+
+/**
+* @brief Device level entry points of the dispatch table (without the vk prefix)
+*
+* Only the functions called per frame (command recording, submission and synchronization) are part of the table,
+* add an entry here to make another function available as vks::DeviceDispatch::<name>
+*/
+#define VKS_DEVICE_DISPATCH_FUNCTIONS(X)	\
+	X(BeginCommandBuffer)					\
+	X(EndCommandBuffer)						\
+	X(CmdBeginRenderPass)					\
+	X(CmdEndRenderPass)						\
+	X(CmdExecuteCommands)					\
+	X(CmdSetViewport)						\
+	X(CmdSetScissor)						\
+	X(CmdBindPipeline)						\
+	X(CmdBindDescriptorSets)				\
+	X(CmdBindVertexBuffers)					\
+	X(CmdBindIndexBuffer)					\
+	X(CmdPushConstants)					\
+	X(CmdDrawIndexed)						\
+	X(CmdDrawIndexedIndirect)				\
+	X(CmdDrawIndirect)						\
+	X(CmdPipelineBarrier)					\
+	X(CmdCopyBuffer)						\
+	X(CmdResetQueryPool)					\
+	X(CmdWriteTimestamp)					\
+	X(QueueSubmit)							\
+	X(WaitForFences)						\
+	X(ResetFences)							\
+	X(GetQueryPoolResults)
+
+/**
+* @brief Device level entry points that are too expensive to be called per frame
+*
+* Part of the table so the call accounting (see VulkanCallAccounting.hpp) can flag them if they show up in the frame loop
+*/
+#define VKS_DEVICE_DISPATCH_EXPENSIVE_FUNCTIONS(X)	\
+	X(AllocateMemory)								\
+	X(FreeMemory)									\
+	X(CreateBuffer)									\
+	X(DestroyBuffer)								\
+	X(QueueWaitIdle)								\
+	X(DeviceWaitIdle)
+
+namespace vks
+{
+	/**
+	* @brief Function pointers of a single logical device
+	*
+	* Generated from VKS_DEVICE_DISPATCH_FUNCTIONS, e.g. vulkanDevice->dispatch.CmdDrawIndexed(...) instead of vkCmdDrawIndexed(...)
+	* The pointers are only valid for the device (and its queues and command buffers) they were loaded for.
+	*/
+	struct DeviceDispatch
+	{
+#define VKS_DEVICE_DISPATCH_MEMBER(name) PFN_vk##name name = nullptr;
+		VKS_DEVICE_DISPATCH_FUNCTIONS(VKS_DEVICE_DISPATCH_MEMBER)
+		VKS_DEVICE_DISPATCH_EXPENSIVE_FUNCTIONS(VKS_DEVICE_DISPATCH_MEMBER)
+#undef VKS_DEVICE_DISPATCH_MEMBER
+
+		/** @brief Resolve all entry points of the table for a logical device */
+		void load(VkDevice device)
+		{
+#define VKS_DEVICE_DISPATCH_LOAD(name)																\
+			name = reinterpret_cast<PFN_vk##name>(vkGetDeviceProcAddr(device, "vk" #name));		\
+			if (!name)																				\
+			{																						\
+				vks::tools::exitFatal("Could not resolve device function vk" #name, "Fatal error");	\
+			}
+			VKS_DEVICE_DISPATCH_FUNCTIONS(VKS_DEVICE_DISPATCH_LOAD)
+			VKS_DEVICE_DISPATCH_EXPENSIVE_FUNCTIONS(VKS_DEVICE_DISPATCH_LOAD)
+#undef VKS_DEVICE_DISPATCH_LOAD
+		}
+	};
+}
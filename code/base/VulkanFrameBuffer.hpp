@@ -91,9 +91,10 @@ namespace vks
 		vks::VulkanDevice *vulkanDevice;
 	public:
 		uint32_t width, height;
-		VkFramebuffer framebuffer;
-		VkRenderPass renderPass;
-		VkSampler sampler;
+		// Only created on request (see createRenderPass and createSampler), null handles are ignored on destruction
+		VkFramebuffer framebuffer = VK_NULL_HANDLE;
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		VkSampler sampler = VK_NULL_HANDLE;
 		std::vector<vks::FramebufferAttachment> attachments;
 
 		/**
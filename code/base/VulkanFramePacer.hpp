@@ -0,0 +1,235 @@
+/*
+* Frame pacing
+*
+* Limits how often frames are started and records where the time of each frame is spent
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <chrono>
+#include <thread>
+#include <sstream>
+#include <iomanip>
+
+#include "VulkanTools.h"
+
+namespace vks
+{
+	/** @brief Goal of the frame pacing */
+	enum FramePacingMode
+	{
+		/** @brief V-synced presentation, frames are started as late as possible so the pose they use is as fresh as possible */
+		FRAME_PACING_LATENCY,
+		/** @brief Unpaced rendering with the lowest latency non v-synced present mode (renders frames that may never be shown) */
+		FRAME_PACING_THROUGHPUT,
+		/** @brief V-synced presentation, frames are started at a fixed rate (targetFrameTime) */
+		FRAME_PACING_FIXED_RATE
+	};
+
+	/** @brief How the host waits until the next frame may start */
+	enum FrameWaitStrategy
+	{
+		/** @brief Sleep the thread (lowest power, wake up may be late by the scheduler granularity) */
+		FRAME_WAIT_SLEEP,
+		/** @brief Sleep until shortly before the deadline, then yield until it has passed */
+		FRAME_WAIT_HYBRID,
+		/** @brief Yield until the deadline has passed (most accurate, keeps a core busy) */
+		FRAME_WAIT_SPIN
+	};
+
+	/** @brief Host side timings of a single frame in milliseconds */
+	struct FrameTimings
+	{
+		/** @brief Time spent acquiring the swap chain image and waiting for its previous frame */
+		double acquireWait = 0.0;
+		/** @brief Time from the acquired image to the start of the frame submission (updates and command recording) */
+		double render = 0.0;
+		/** @brief Time from the start of the frame submission until the present has been queued */
+		double submitToPresent = 0.0;
+		/** @brief Time the pacer waited before the frame started */
+		double pacingWait = 0.0;
+		/** @brief Time between the start of this and the previous frame */
+		double frameTime = 0.0;
+		/** @brief Number of target intervals missed by this frame (0 if it was on time) */
+		uint32_t missedIntervals = 0;
+	};
+
+	/**
+	* @brief Paces the render loop and collects per frame telemetry
+	*
+	* The render loop calls waitForNextFrame before each frame, the frame itself reports
+	* its stages with beginAcquire, endAcquire, beginSubmit and endPresent.
+	*/
+	class FramePacer
+	{
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		Clock::time_point frameStart;
+		Clock::time_point acquireStart;
+		Clock::time_point acquireEnd;
+		Clock::time_point submitStart;
+		bool started = false;
+
+		/** @brief Weight of the latest frame in the rolling averages */
+		const double averageWeight = 0.1;
+
+		static double milliseconds(Clock::time_point from, Clock::time_point to)
+		{
+			return std::chrono::duration<double, std::milli>(to - from).count();
+		}
+
+		void waitUntil(Clock::time_point deadline)
+		{
+			switch (waitStrategy)
+			{
+			case FRAME_WAIT_SLEEP:
+				std::this_thread::sleep_until(deadline);
+				break;
+			case FRAME_WAIT_HYBRID:
+			{
+				Clock::time_point wakeUp = deadline - std::chrono::microseconds(static_cast<int64_t>(spinThreshold * 1000.0));
+				if (Clock::now() < wakeUp)
+				{
+					std::this_thread::sleep_until(wakeUp);
+				}
+				while (Clock::now() < deadline)
+				{
+					std::this_thread::yield();
+				}
+				break;
+			}
+			case FRAME_WAIT_SPIN:
+				while (Clock::now() < deadline)
+				{
+					std::this_thread::yield();
+				}
+				break;
+			}
+		}
+
+	public:
+		FramePacingMode mode = FRAME_PACING_LATENCY;
+		FrameWaitStrategy waitStrategy = FRAME_WAIT_HYBRID;
+		/** @brief Frame time the pacing aims for in milliseconds (the display interval for the latency mode) */
+		double targetFrameTime = 1000.0 / 60.0;
+		/** @brief Hybrid waits switch from sleeping to yielding this many milliseconds before the deadline */
+		double spinThreshold = 1.0;
+		/** @brief Extra time in milliseconds the latency mode starts a frame ahead of its predicted duration */
+		double latencyMargin = 2.0;
+
+		/** @brief Timings of the last completed frame */
+		FrameTimings last;
+		/** @brief Exponential rolling averages of the frame timings */
+		FrameTimings average;
+		/** @brief Total number of missed target intervals */
+		uint64_t missedIntervals = 0;
+
+		/** @brief True if the mode requires v-synced presentation (FIFO) */
+		bool vsync() const
+		{
+			return mode != FRAME_PACING_THROUGHPUT;
+		}
+
+		/**
+		* Wait until the next frame should be started according to the pacing mode
+		* Also closes the timings of the previous frame
+		*/
+		void waitForNextFrame()
+		{
+			Clock::time_point now = Clock::now();
+			if (started)
+			{
+				Clock::time_point deadline = now;
+				if (mode == FRAME_PACING_FIXED_RATE)
+				{
+					deadline = frameStart + std::chrono::microseconds(static_cast<int64_t>(targetFrameTime * 1000.0));
+				}
+				else if (mode == FRAME_PACING_LATENCY)
+				{
+					// Start late enough that the frame (as predicted by the averages) finishes just in time for the next interval
+					double predicted = average.acquireWait + average.render + average.submitToPresent + latencyMargin;
+					double delay = targetFrameTime - predicted;
+					if (delay > 0.0)
+					{
+						deadline = frameStart + std::chrono::microseconds(static_cast<int64_t>(delay * 1000.0));
+					}
+				}
+				if (deadline > now)
+				{
+					waitUntil(deadline);
+				}
+			}
+
+			Clock::time_point start = Clock::now();
+			if (started)
+			{
+				last.pacingWait = milliseconds(now, start);
+				last.frameTime = milliseconds(frameStart, start);
+				// Frames that took longer than the target (with half an interval of tolerance) missed at least one interval
+				last.missedIntervals = 0;
+				if (mode != FRAME_PACING_THROUGHPUT && targetFrameTime > 0.0)
+				{
+					double intervals = last.frameTime / targetFrameTime;
+					if (intervals > 1.5)
+					{
+						last.missedIntervals = static_cast<uint32_t>(intervals - 0.5);
+					}
+				}
+				missedIntervals += last.missedIntervals;
+
+				average.acquireWait += (last.acquireWait - average.acquireWait) * averageWeight;
+				average.render += (last.render - average.render) * averageWeight;
+				average.submitToPresent += (last.submitToPresent - average.submitToPresent) * averageWeight;
+				average.pacingWait += (last.pacingWait - average.pacingWait) * averageWeight;
+				average.frameTime += (last.frameTime - average.frameTime) * averageWeight;
+			}
+			frameStart = start;
+			started = true;
+		}
+
+		/** @brief Called before the swap chain image is acquired */
+		void beginAcquire()
+		{
+			acquireStart = Clock::now();
+		}
+
+		/** @brief Called once the image has been acquired and its previous frame has finished */
+		void endAcquire()
+		{
+			acquireEnd = Clock::now();
+			last.acquireWait = milliseconds(acquireStart, acquireEnd);
+		}
+
+		/** @brief Called right before the frame's first submit (the scene), the CPU work in between counts as render time */
+		void beginSubmit()
+		{
+			submitStart = Clock::now();
+			last.render = milliseconds(acquireEnd, submitStart);
+		}
+
+		/** @brief Called after the frame has been queued for presentation */
+		void endPresent()
+		{
+			last.submitToPresent = milliseconds(submitStart, Clock::now());
+		}
+
+		/** @brief Restart the timings, e.g. after the loop has been paused, so the pause doesn't count as a missed frame */
+		void reset()
+		{
+			started = false;
+		}
+
+		/** @brief Short summary of the averaged telemetry, e.g. for the text overlay or the log */
+		std::string getSummary() const
+		{
+			std::stringstream ss;
+			ss << std::fixed << std::setprecision(2)
+				<< "acquire " << average.acquireWait << "ms render " << average.render << "ms present " << average.submitToPresent
+				<< "ms wait " << average.pacingWait << "ms missed " << missedIntervals;
+			return ss.str();
+		}
+	};
+}
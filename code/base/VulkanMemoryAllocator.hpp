@@ -0,0 +1,520 @@
+/*
+* Vulkan device memory sub-allocator
+*
+* Allocates large device memory blocks per memory type and hands out ranges of them,
+* so that creating a buffer or image doesn't require a vkAllocateMemory call
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <assert.h>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanDeviceDispatch.hpp"
+
+namespace vks
+{
+	/** @brief Sub-allocation strategy of a memory block */
+	typedef enum AllocationStrategy {
+		/** @brief First fit from a sorted list of free ranges, freed ranges are merged with their neighbours */
+		ALLOCATION_STRATEGY_FREE_LIST = 0x0,
+		/** @brief Offset bump, memory is only reclaimed once all allocations of the block have been freed (short lived resources like staging buffers) */
+		ALLOCATION_STRATEGY_LINEAR = 0x1
+	} AllocationStrategy;
+
+	/** @brief Type of resource bound to a range, used to respect bufferImageGranularity between linear and optimal resources */
+	typedef enum AllocationKind {
+		ALLOCATION_KIND_FREE = 0x0,
+		/** @brief Buffers and linear tiled images */
+		ALLOCATION_KIND_LINEAR = 0x1,
+		/** @brief Optimal tiled images */
+		ALLOCATION_KIND_OPTIMAL = 0x2
+	} AllocationKind;
+
+	struct MemoryBlock;
+
+	/** @brief A range of device memory handed out by the MemoryAllocator */
+	struct Allocation
+	{
+		/** @brief Device memory the range belongs to (shared with other allocations) */
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		/** @brief Byte offset of the range inside of memory, to be used for binding, mapping and flushing */
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		/** @brief Host pointer to the start of the range if the memory type is host visible (blocks are persistently mapped) */
+		void *mapped = nullptr;
+		uint32_t memoryTypeIndex = 0;
+		MemoryBlock *block = nullptr;
+	};
+
+	/** @brief A single device memory allocation that is split into sub-allocations */
+	struct MemoryBlock
+	{
+		/** @brief Range of the block, the ranges of a block are sorted by offset and cover the whole block */
+		struct Range
+		{
+			VkDeviceSize offset;
+			VkDeviceSize size;
+			AllocationKind kind;
+		};
+
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		uint32_t memoryTypeIndex = 0;
+		AllocationStrategy strategy = ALLOCATION_STRATEGY_FREE_LIST;
+		void *mapped = nullptr;
+		/** @brief Block holds a single resource that was too large for the default block size */
+		bool dedicated = false;
+
+		/** @brief Bytes currently handed out (including alignment padding) */
+		VkDeviceSize used = 0;
+		uint32_t allocationCount = 0;
+
+		/** @brief Free list strategy: used and free ranges */
+		std::vector<Range> ranges;
+
+		/** @brief Linear strategy: next free offset and kind of the last allocation */
+		VkDeviceSize linearOffset = 0;
+		AllocationKind linearKind = ALLOCATION_KIND_FREE;
+
+		static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+		{
+			return (value + alignment - 1) & ~(alignment - 1);
+		}
+
+		/** @brief Linear and optimal resources must not share a bufferImageGranularity page */
+		static bool kindsConflict(AllocationKind a, AllocationKind b)
+		{
+			return (a != ALLOCATION_KIND_FREE) && (b != ALLOCATION_KIND_FREE) && (a != b);
+		}
+
+		/** @brief Returns true if the last byte of resource a and the first byte of resource b are on the same page */
+		static bool onSamePage(VkDeviceSize aOffset, VkDeviceSize aSize, VkDeviceSize bOffset, VkDeviceSize pageSize)
+		{
+			VkDeviceSize aEndPage = (aOffset + aSize - 1) & ~(pageSize - 1);
+			VkDeviceSize bStartPage = bOffset & ~(pageSize - 1);
+			return aEndPage == bStartPage;
+		}
+
+		void init(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryTypeIndex, AllocationStrategy strategy, void *mapped)
+		{
+			this->memory = memory;
+			this->size = size;
+			this->memoryTypeIndex = memoryTypeIndex;
+			this->strategy = strategy;
+			this->mapped = mapped;
+			ranges.clear();
+			ranges.push_back({ 0, size, ALLOCATION_KIND_FREE });
+		}
+
+		/**
+		* Try to find a range for the requested size inside of this block
+		*
+		* @param size Size of the requested range
+		* @param alignment Required alignment of the start offset
+		* @param kind Type of the resource the range will be bound to
+		* @param granularity bufferImageGranularity of the device
+		* @param offset Pointer to the offset of the range if successful
+		*
+		* @return True if the range fits into this block
+		*/
+		bool allocate(VkDeviceSize size, VkDeviceSize alignment, AllocationKind kind, VkDeviceSize granularity, VkDeviceSize *offset)
+		{
+			if (strategy == ALLOCATION_STRATEGY_LINEAR)
+			{
+				VkDeviceSize start = alignUp(linearOffset, alignment);
+				if ((linearOffset > 0) && kindsConflict(linearKind, kind))
+				{
+					start = alignUp(start, granularity);
+				}
+				if (start + size > this->size)
+				{
+					return false;
+				}
+				used += (start + size) - linearOffset;
+				linearOffset = start + size;
+				linearKind = kind;
+				allocationCount++;
+				*offset = start;
+				return true;
+			}
+
+			for (size_t i = 0; i < ranges.size(); i++)
+			{
+				const Range range = ranges[i];
+				if ((range.kind != ALLOCATION_KIND_FREE) || (range.size < size))
+				{
+					continue;
+				}
+				VkDeviceSize start = alignUp(range.offset, alignment);
+				if ((i > 0) && kindsConflict(ranges[i - 1].kind, kind) && onSamePage(ranges[i - 1].offset, ranges[i - 1].size, start, granularity))
+				{
+					start = alignUp(start, granularity);
+				}
+				if (start + size > range.offset + range.size)
+				{
+					continue;
+				}
+				if ((i + 1 < ranges.size()) && kindsConflict(kind, ranges[i + 1].kind) && onSamePage(start, size, ranges[i + 1].offset, granularity))
+				{
+					continue;
+				}
+
+				// Split the free range into [padding][allocation][remainder]
+				VkDeviceSize padding = start - range.offset;
+				VkDeviceSize remainder = (range.offset + range.size) - (start + size);
+				ranges[i] = { start, size, kind };
+				if (remainder > 0)
+				{
+					ranges.insert(ranges.begin() + i + 1, { start + size, remainder, ALLOCATION_KIND_FREE });
+				}
+				if (padding > 0)
+				{
+					ranges.insert(ranges.begin() + i, { range.offset, padding, ALLOCATION_KIND_FREE });
+				}
+				used += size;
+				allocationCount++;
+				*offset = start;
+				return true;
+			}
+			return false;
+		}
+
+		/** @brief Return the range starting at offset to the block */
+		void free(VkDeviceSize offset)
+		{
+			assert(allocationCount > 0);
+			allocationCount--;
+
+			if (strategy == ALLOCATION_STRATEGY_LINEAR)
+			{
+				// Memory of a linear block is reclaimed as a whole
+				if (allocationCount == 0)
+				{
+					linearOffset = 0;
+					linearKind = ALLOCATION_KIND_FREE;
+					used = 0;
+				}
+				return;
+			}
+
+			for (size_t i = 0; i < ranges.size(); i++)
+			{
+				if ((ranges[i].offset != offset) || (ranges[i].kind == ALLOCATION_KIND_FREE))
+				{
+					continue;
+				}
+				used -= ranges[i].size;
+				ranges[i].kind = ALLOCATION_KIND_FREE;
+				// Merge with the following and preceding free ranges
+				if ((i + 1 < ranges.size()) && (ranges[i + 1].kind == ALLOCATION_KIND_FREE))
+				{
+					ranges[i].size += ranges[i + 1].size;
+					ranges.erase(ranges.begin() + i + 1);
+				}
+				if ((i > 0) && (ranges[i - 1].kind == ALLOCATION_KIND_FREE))
+				{
+					ranges[i - 1].size += ranges[i].size;
+					ranges.erase(ranges.begin() + i);
+				}
+				return;
+			}
+			assert(!"Freed offset is not an allocation of this block");
+		}
+
+		/** @brief Size of the largest free range (for fragmentation statistics) */
+		VkDeviceSize largestFreeRange() const
+		{
+			if (strategy == ALLOCATION_STRATEGY_LINEAR)
+			{
+				return size - linearOffset;
+			}
+			VkDeviceSize largest = 0;
+			for (auto& range : ranges)
+			{
+				if ((range.kind == ALLOCATION_KIND_FREE) && (range.size > largest))
+				{
+					largest = range.size;
+				}
+			}
+			return largest;
+		}
+	};
+
+	/** @brief Allocation statistics, summed up over all blocks */
+	struct MemoryStats
+	{
+		/** @brief Number of device memory allocations (vkAllocateMemory calls currently alive) */
+		uint32_t blockCount = 0;
+		/** @brief Number of sub-allocations handed out */
+		uint32_t allocationCount = 0;
+		/** @brief Total size of all blocks */
+		VkDeviceSize allocatedBytes = 0;
+		/** @brief Bytes used by sub-allocations */
+		VkDeviceSize usedBytes = 0;
+		/** @brief Free bytes that are not part of the largest free range of their block */
+		VkDeviceSize fragmentedBytes = 0;
+
+		/** @brief Fraction of the free memory that can't be used for the largest possible allocation (0 = no fragmentation) */
+		float fragmentation() const
+		{
+			VkDeviceSize freeBytes = allocatedBytes - usedBytes;
+			return (freeBytes > 0) ? (float)fragmentedBytes / (float)freeBytes : 0.0f;
+		}
+	};
+
+	/**
+	* @brief Block based device memory sub-allocator, one set of blocks per memory type and strategy
+	* @note Host visible blocks are mapped once at creation and stay mapped until the block is released
+	*/
+	class MemoryAllocator
+	{
+	private:
+		VkDevice device;
+		const vks::DeviceDispatch *dispatch;
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		VkDeviceSize bufferImageGranularity;
+		VkDeviceSize nonCoherentAtomSize;
+		std::vector<MemoryBlock*> blocks;
+		/** @brief Bytes allocated from each memory heap */
+		std::vector<VkDeviceSize> heapUsage;
+		std::mutex lock;
+		uint32_t totalDeviceAllocations = 0;
+
+		VkDeviceSize blockSizeForHeap(uint32_t heapIndex) const
+		{
+			// Small heaps (e.g. host visible device local carve outs) use a fraction of the heap
+			VkDeviceSize heapSize = memoryProperties.memoryHeaps[heapIndex].size;
+			return (heapSize <= 256 * 1024 * 1024) ? heapSize / 8 : defaultBlockSize;
+		}
+
+		MemoryBlock *createBlock(VkDeviceSize size, uint32_t memoryTypeIndex, AllocationStrategy strategy)
+		{
+			const VkMemoryType &memoryType = memoryProperties.memoryTypes[memoryTypeIndex];
+
+			VkDeviceSize budget, usage;
+			getBudget(memoryType.heapIndex, &budget, &usage);
+			if (usage + size > budget)
+			{
+#if defined(__ANDROID__)
+				LOGW("Memory heap %d exceeds its budget (%d MB of %d MB)", memoryType.heapIndex, (int)((usage + size) >> 20), (int)(budget >> 20));
+#else
+				std::cout << "Memory heap " << memoryType.heapIndex << " exceeds its budget (" << ((usage + size) >> 20) << " MB of " << (budget >> 20) << " MB)" << std::endl;
+#endif
+			}
+
+			VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+			memAlloc.allocationSize = size;
+			memAlloc.memoryTypeIndex = memoryTypeIndex;
+			VkDeviceMemory memory;
+			if (dispatch->AllocateMemory(device, &memAlloc, nullptr, &memory) != VK_SUCCESS)
+			{
+				return nullptr;
+			}
+			totalDeviceAllocations++;
+			heapUsage[memoryType.heapIndex] += size;
+
+			void *mapped = nullptr;
+			if (memoryType.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+			{
+				VK_CHECK_RESULT(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+			}
+
+			MemoryBlock *block = new MemoryBlock();
+			block->init(memory, size, memoryTypeIndex, strategy, mapped);
+			blocks.push_back(block);
+			return block;
+		}
+
+		void destroyBlock(MemoryBlock *block)
+		{
+			heapUsage[memoryProperties.memoryTypes[block->memoryTypeIndex].heapIndex] -= block->size;
+			// Freeing the memory implicitly unmaps it
+			dispatch->FreeMemory(device, block->memory, nullptr);
+			blocks.erase(std::find(blocks.begin(), blocks.end(), block));
+			delete block;
+		}
+
+	public:
+		/** @brief Default size of a newly created block */
+		VkDeviceSize defaultBlockSize = 32 * 1024 * 1024;
+		/** @brief Fraction of a heap the application is expected to use (Vulkan 1.0 has no budget query) */
+		float heapBudgetFraction = 0.8f;
+
+		/**
+		* Default constructor
+		*
+		* @param device Logical device to allocate memory from
+		* @param dispatch Dispatch table of the device (block allocations go through it)
+		* @param memoryProperties Memory types and heaps of the physical device
+		* @param limits Limits of the physical device (for bufferImageGranularity and nonCoherentAtomSize)
+		*/
+		MemoryAllocator(VkDevice device, const vks::DeviceDispatch *dispatch, const VkPhysicalDeviceMemoryProperties &memoryProperties, const VkPhysicalDeviceLimits &limits)
+		{
+			this->device = device;
+			this->dispatch = dispatch;
+			this->memoryProperties = memoryProperties;
+			bufferImageGranularity = limits.bufferImageGranularity;
+			nonCoherentAtomSize = limits.nonCoherentAtomSize;
+			heapUsage.resize(memoryProperties.memoryHeapCount, 0);
+		}
+
+		/** @brief Releases all blocks, all allocations must have been freed before */
+		~MemoryAllocator()
+		{
+			while (!blocks.empty())
+			{
+				destroyBlock(blocks.back());
+			}
+		}
+
+		/**
+		* Sub-allocate a range of device memory
+		*
+		* @param memReqs Memory requirements of the resource (from vkGet*MemoryRequirements)
+		* @param memoryTypeIndex Index of the memory type to allocate from
+		* @param kind Type of resource the memory will be bound to
+		* @param strategy Block strategy to allocate from
+		* @param allocation Pointer to the allocation that is filled on success
+		*
+		* @return VK_SUCCESS or VK_ERROR_OUT_OF_DEVICE_MEMORY if no block could be created
+		*/
+		VkResult allocate(const VkMemoryRequirements &memReqs, uint32_t memoryTypeIndex, AllocationKind kind, AllocationStrategy strategy, vks::Allocation *allocation)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+
+			VkDeviceSize size = memReqs.size;
+			VkDeviceSize alignment = memReqs.alignment;
+			const VkMemoryType &memoryType = memoryProperties.memoryTypes[memoryTypeIndex];
+			// Non-coherent ranges are flushed in multiples of nonCoherentAtomSize, so they must not share atoms
+			if ((memoryType.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(memoryType.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+			{
+				alignment = std::max(alignment, nonCoherentAtomSize);
+				size = MemoryBlock::alignUp(size, nonCoherentAtomSize);
+			}
+
+			MemoryBlock *block = nullptr;
+			VkDeviceSize offset = 0;
+
+			VkDeviceSize blockSize = blockSizeForHeap(memoryType.heapIndex);
+			if (size > blockSize / 2)
+			{
+				// Large resources get a block of their own
+				block = createBlock(size, memoryTypeIndex, strategy);
+				if (!block)
+				{
+					return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+				}
+				block->dedicated = true;
+				block->allocate(size, alignment, kind, bufferImageGranularity, &offset);
+			}
+			else
+			{
+				for (auto b : blocks)
+				{
+					if ((b->memoryTypeIndex == memoryTypeIndex) && (b->strategy == strategy) && !b->dedicated && b->allocate(size, alignment, kind, bufferImageGranularity, &offset))
+					{
+						block = b;
+						break;
+					}
+				}
+				if (!block)
+				{
+					block = createBlock(blockSize, memoryTypeIndex, strategy);
+					if (!block)
+					{
+						return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+					}
+					block->allocate(size, alignment, kind, bufferImageGranularity, &offset);
+				}
+			}
+
+			allocation->memory = block->memory;
+			allocation->offset = offset;
+			allocation->size = size;
+			allocation->mapped = block->mapped ? static_cast<char*>(block->mapped) + offset : nullptr;
+			allocation->memoryTypeIndex = memoryTypeIndex;
+			allocation->block = block;
+			return VK_SUCCESS;
+		}
+
+		/** @brief Return an allocation to its block, empty blocks are released except for one block per memory type and strategy */
+		void free(vks::Allocation *allocation)
+		{
+			if (!allocation->block)
+			{
+				return;
+			}
+			std::lock_guard<std::mutex> guard(lock);
+
+			MemoryBlock *block = allocation->block;
+			block->free(allocation->offset);
+			if (block->allocationCount == 0)
+			{
+				bool keep = false;
+				if (!block->dedicated)
+				{
+					// Keep one empty block around to avoid allocation ping-pong
+					keep = true;
+					for (auto b : blocks)
+					{
+						if ((b != block) && (b->memoryTypeIndex == block->memoryTypeIndex) && (b->strategy == block->strategy) && !b->dedicated && (b->allocationCount == 0))
+						{
+							keep = false;
+							break;
+						}
+					}
+				}
+				if (!keep)
+				{
+					destroyBlock(block);
+				}
+			}
+			*allocation = vks::Allocation();
+		}
+
+		/**
+		* Get the estimated memory budget of a heap
+		*
+		* @param heapIndex Index of the memory heap
+		* @param budget Pointer to the number of bytes the application should stay below
+		* @param usage Pointer to the number of bytes currently allocated from the heap by this allocator
+		*
+		* @note Without VK_EXT_memory_budget this is a fixed fraction of the heap size
+		*/
+		void getBudget(uint32_t heapIndex, VkDeviceSize *budget, VkDeviceSize *usage) const
+		{
+			assert(heapIndex < memoryProperties.memoryHeapCount);
+			*budget = (VkDeviceSize)(memoryProperties.memoryHeaps[heapIndex].size * heapBudgetFraction);
+			*usage = heapUsage[heapIndex];
+		}
+
+		/** @brief Get the statistics over all blocks */
+		MemoryStats getStats()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			MemoryStats stats;
+			for (auto block : blocks)
+			{
+				stats.blockCount++;
+				stats.allocationCount += block->allocationCount;
+				stats.allocatedBytes += block->size;
+				stats.usedBytes += block->used;
+				stats.fragmentedBytes += (block->size - block->used) - block->largestFreeRange();
+			}
+			return stats;
+		}
+
+		/** @brief Number of vkAllocateMemory calls done over the lifetime of the allocator */
+		uint32_t getDeviceAllocationCount() const
+		{
+			return totalDeviceAllocations;
+		}
+	};
+}
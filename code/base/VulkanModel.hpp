@@ -12,6 +12,7 @@
 #include <string>
 #include <fstream>
 #include <vector>
+#include <algorithm>
 
 #include "vulkan/vulkan.h"
 
@@ -26,6 +27,7 @@
 
 #include "VulkanDevice.hpp"
 #include "VulkanBuffer.hpp"
+#include "VulkanUploadQueue.hpp"
 
 #if defined(__ANDROID__)
 #include <android/asset_manager.h>
@@ -35,30 +37,94 @@
 
 namespace vks
 {
+	/** @brief A mesh file to import as a mesh type of a model (see Model::importFromFiles) */
+	struct MeshFile {
+		std::string filename;
+		float scale;
+	};
 
 	struct Model {
 		VkDevice device = nullptr;
 		vks::Buffer vertices;
 		vks::Buffer indices;
 		uint32_t indexCount = 0;
-        uint32_t currentVBufferSize = 0;
+		/** @brief Type of the indices in the index buffer, 16 bit while all vertices can be addressed with them */
+		VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+
+		/** @brief Per instance data (see vks::ModelX::instances), bound with the instance input rate */
+		/** @note Holds a region of instanceCapacity bytes per frame in flight (see frameOffset), a frame's region is only written once that frame has finished (see updateFrame) */
+		vks::Buffer instanceData;
+		uint32_t instanceCount = 0;
+
+		/** @brief Host visible staging buffer of the instance data with the same regions, kept alive and mapped between updates (unused if the buffer lives in unified memory) */
+		vks::Buffer instanceStaging;
+
+		/** @brief Indirect draw parameters per frame in flight, draw group and instance bucket (see drawCommandOffset), the instance counts are read by the GPU so they can change without re-recording command buffers */
+		/** @note Buckets drawn as impostors have no instances in these commands, so a group's commands can be drawn with a single multi-draw */
+		vks::Buffer drawCommand;
+		/** @brief Indirect draw parameters per frame, draw group and bucket for pipelines that draw the instances as impostors (one quad of 4 vertices each) */
+		vks::Buffer impostorDrawCommand;
+
+		/** @brief Number of frames in flight, each one draws from its own region of the instance and indirect buffers (see setFrameCount) */
+		uint32_t frameCount = 1;
+		/** @brief Instance and staging buffers replaced by a reallocation while frames were in flight, released once every frame has been updated from the new ones */
+		std::vector<vks::Buffer> retiredBuffers;
+		/** @brief Frames (one bit each) that haven't been updated since the buffers were retired */
+		uint32_t retiringFrames = 0;
+
+		/** @brief Number of indirect draw commands each bucket's instances are split into (set before loading), e.g. to record the groups in parallel */
+		uint32_t drawGroupCount = 1;
+		/** @brief Pass the first instance of the draws in the commands (needs the drawIndirectFirstInstance feature, set before loading), otherwise it's applied as an offset of the instance buffer binding */
+		bool useFirstInstance = false;
+		/** @brief First instance and instance count of each draw (see drawIndex) for the latest instances, the binding offset is 0 if useFirstInstance is set (see instanceOffset) */
+		std::vector<uint32_t> drawFirstInstance;
+		std::vector<uint32_t> drawInstanceCount;
+		/** @brief Indirect draw parameters for the latest instances, copied to a frame's region of the indirect buffers by updateFrame */
+		std::vector<VkDrawIndexedIndirectCommand> drawCommands;
+		std::vector<VkDrawIndirectCommand> impostorDrawCommands;
+
+		/** @brief Currently allocated size of each frame's region of the instance buffer (may be larger than the data it holds) */
+		VkDeviceSize instanceCapacity = 0;
+
+		/** @brief Number of instances written by the last frame update (only the ones that changed since that frame's previous update, unless the buffer was reallocated) */
+		uint32_t uploadedInstances = 0;
+		/** @brief Dirty instances closer than this are uploaded as one region, including the clean ones between them */
+		uint32_t mergeGap = 4;
+		/** @brief Upper limit of the copy regions per update, closer ranges are merged until they fit */
+		uint32_t maxCopyRegions = 64;
+		/** @brief Ranges and copy regions of the last frame update (kept to avoid allocations per update) */
+		std::vector<InstanceRange> dirtyRanges;
+		std::vector<VkBufferCopy> copyRegions;
+
+		/** @brief Number of consecutive updates the data used less than a quarter of the capacity */
+		uint32_t underusedUpdates = 0;
+
+		/** @brief Minimum size of a (re)allocated buffer */
+		static const VkDeviceSize minCapacity = 64 * 1024;
+		/** @brief Consecutive underused updates before the buffers are shrunk */
+		static const uint32_t shrinkDelay = 300;
 
         // Used to load data from the file and server
 		ModelX model;
 
+		/** @brief Layout of the imported vertices, packed encodings are converted when the vertices are written to the GPU */
+		vks::VertexLayout layout = vks::VertexLayout({});
+		/** @brief Bounds box of the positions in the vertex buffer (the quantization box of VERTEX_COMPONENT_POSITION_SNORM16) */
+		vks::VertexBounds bounds;
+
 		static const int defaultFlags = aiProcess_FlipWindingOrder | aiProcess_Triangulate | aiProcess_PreTransformVertices | aiProcess_CalcTangentSpace | aiProcess_GenSmoothNormals;
 
 		/** @brief Release all Vulkan resources of this model */
 		void destroy()
 		{		
 			assert(device);
-			vkDestroyBuffer(device, vertices.buffer, nullptr);
-			vkFreeMemory(device, vertices.memory, nullptr);
-			if (indices.buffer != VK_NULL_HANDLE)
-			{
-				vkDestroyBuffer(device, indices.buffer, nullptr);
-				vkFreeMemory(device, indices.memory, nullptr);
-			}
+			vertices.destroy();
+			indices.destroy();
+			instanceData.destroy();
+			instanceStaging.destroy();
+			drawCommand.destroy();
+			impostorDrawCommand.destroy();
+			releaseRetiredBuffers();
 		}
 
 		/**
@@ -73,196 +139,438 @@ namespace vks
 		*/
         bool loadFromFile(const std::string& filename, vks::VertexLayout layout, float scale, vks::VulkanDevice *device, VkQueue copyQueue, const int flags = defaultFlags)
         {
-            this->device = device->logicalDevice;
+            importFromFile(filename, layout, scale, flags);
+            return upload(device, copyQueue);
+        }
+
+        /**
+        * CPU side part of loadFromFile: imports the mesh and builds the rendering data, doesn't touch any Vulkan objects
+        * so it can run on a worker thread (e.g. while the device is still being set up)
+        */
+        bool importFromFile(const std::string& filename, vks::VertexLayout layout, float scale, const int flags = defaultFlags)
+        {
+            MeshFile file = { filename, scale };
+            return importFromFiles(std::vector<MeshFile>(1, file), layout, flags);
+        }
 
-            // load the model data from file
-            model.loadFromFile(filename, layout, scale, flags);
+        /**
+        * Import several meshes as the mesh types of the model, the mesh channel of the streamed points selects the type
+        * (index in files). All types share the vertex and index buffers.
+        */
+        bool importFromFiles(const std::vector<MeshFile>& files, vks::VertexLayout layout, const int flags = defaultFlags)
+        {
+            this->layout = layout;
+            // load the model data from the files
+            bool loaded = !files.empty();
+            for (auto& file : files) {
+                loaded = model.loadFromFile(file.filename, layout, file.scale, flags) && loaded;
+            }
             // update the rendering data according to the configure data from server
             model.loadFromServer();
+            return loaded;
+        }
 
-            std::vector<float> * vertexBuffer;
-            std::vector<uint32_t> * indexBuffer;
+        /**
+        * Vulkan part of loadFromFile: creates the buffers for the imported data and uploads it
+        *
+        * @note Submits to copyQueue, so it must run on the thread that owns the queue
+        */
+        bool upload(vks::VulkanDevice *device, VkQueue copyQueue)
+        {
+            this->device = device->logicalDevice;
 
-            if(model.renderingVerticesCount > 0){
-                vertexBuffer = &model.renderingVertices;
-            }else{
-                vertexBuffer = &model.vertexBuffer;
-            }
+            assert(drawGroupCount > 0);
+            const uint32_t drawCount = drawGroupCount * std::max(model.bucketCount(), 1u);
+            drawFirstInstance.resize(drawCount, 0);
+            drawInstanceCount.resize(drawCount, 0);
+            drawCommands.resize(drawCount);
+            impostorDrawCommands.resize(drawCount);
+            allocateDrawCommands(device);
 
-            if(model.renderingIndicesCount > 0){
-                indexBuffer = &model.renderingIndices;
-                indexCount = model.renderingIndicesCount;
-            }else{
-                indexBuffer = &model.indexBuffer;
-                indexCount = model.indexCount;
-            }
+            uploadMesh(device, copyQueue);
+            updateInstances(device);
 
-            uint32_t vBufferSize = static_cast<uint32_t>(vertexBuffer->size()) * sizeof(float);
-            uint32_t iBufferSize = static_cast<uint32_t>(indexBuffer->size()) * sizeof(uint32_t);
-            currentVBufferSize = vBufferSize;
+            return true;
 
-            // Use staging buffer to move vertex and index buffer to device local memory
-            // Create staging buffers
-            vks::Buffer vertexStaging, indexStaging;
+        }
 
-            // Vertex buffer
-            VK_CHECK_RESULT(device->createBuffer(
-                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-                    &vertexStaging,
-                    vBufferSize,
-                    vertexBuffer->data()));
+        /**
+        * Set the number of frames in flight, each one gets its own region of the instance and indirect buffers
+        * All regions are written by the next updateFrame of their frame
+        *
+        * @note Must not be called while frames are in flight (e.g. when the swap chain is created)
+        */
+        void setFrameCount(vks::VulkanDevice *device, uint32_t count)
+        {
+            assert(count > 0 && count <= InstanceStore::maxFrames);
+            if (count == frameCount) {
+                return;
+            }
+            releaseRetiredBuffers();
+            frameCount = count;
+            allocateDrawCommands(device);
+            if (instanceCapacity > 0) {
+                allocateBuffer(device, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, instanceCapacity * frameCount, &instanceData, &instanceStaging);
+            }
+            model.instances.setFrameCount(frameCount);
+        }
 
-            // Index buffer
+        // (re)create the indirect draw buffers with a region per frame, persistently mapped so the instance counts can be updated from the host
+        void allocateDrawCommands(vks::VulkanDevice *device)
+        {
+            const VkDeviceSize drawCount = drawCommands.size();
+            drawCommand.destroy();
+            impostorDrawCommand.destroy();
             VK_CHECK_RESULT(device->createBuffer(
-                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-                    &indexStaging,
-                    iBufferSize,
-                    indexBuffer->data()));
-
-            // Create device local target buffers
-            // Vertex buffer
+                    VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    &drawCommand,
+                    frameCount * drawCount * sizeof(VkDrawIndexedIndirectCommand)));
+            VK_CHECK_RESULT(drawCommand.map());
             VK_CHECK_RESULT(device->createBuffer(
-                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                    &vertices,
-                    vBufferSize));
+                    VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    &impostorDrawCommand,
+                    frameCount * drawCount * sizeof(VkDrawIndirectCommand)));
+            VK_CHECK_RESULT(impostorDrawCommand.map());
+        }
 
-            // Index buffer
-            VK_CHECK_RESULT(device->createBuffer(
-                    VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                    &indices,
-                    iBufferSize));
+        /**
+        * Get the capacity a buffer needs to hold the requested size
+        *
+        * Grows geometrically so a slowly increasing size only reallocates a logarithmic number of times
+        * Shrinking is left to shrinkCapacity, so a fluctuating size never reallocates
+        *
+        * @param capacity Current capacity (0 if not allocated yet)
+        * @param required Size of the data that has to fit
+        *
+        * @return New capacity, equal to capacity if no reallocation is required
+        */
+        static VkDeviceSize growCapacity(VkDeviceSize capacity, VkDeviceSize required)
+        {
+            if (capacity > 0 && required <= capacity) {
+                return capacity;
+            }
+            VkDeviceSize newCapacity = (capacity > minCapacity) ? capacity : minCapacity;
+            while (newCapacity < required) {
+                newCapacity *= 2;
+            }
+            return newCapacity;
+        }
+
+        // return true if the instance buffer needs to shrink
+        // only happens after the data stayed below a quarter of the capacity for shrinkDelay updates in a row
+        bool shrinkCapacity(VkDeviceSize size)
+        {
+            if (instanceCapacity > minCapacity && size * 4 < instanceCapacity) {
+                underusedUpdates++;
+            } else {
+                underusedUpdates = 0;
+            }
+            if (underusedUpdates < shrinkDelay) {
+                return false;
+            }
+            underusedUpdates = 0;
+            return true;
+        }
 
-            // Copy from staging buffers
-            VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-                                                                  true);
+        // (re)create a device local buffer with the given capacity
+        // on unified memory the buffer is mapped and written in place, otherwise a staging buffer is created along with it
+        void allocateBuffer(vks::VulkanDevice *device, VkBufferUsageFlags usage, VkDeviceSize capacity, vks::Buffer *buffer, vks::Buffer *staging)
+        {
+            buffer->destroy();
+            staging->destroy();
+
+            if (device->unifiedMemory) {
+                if (device->createBuffer(
+                        usage,
+                        device->unifiedMemoryPropertyFlags,
+                        buffer,
+                        capacity) == VK_SUCCESS) {
+                    VK_CHECK_RESULT(buffer->map());
+                    return;
+                }
+                // The unified memory type doesn't support this buffer usage, use the staged path
+            }
 
-            VkBufferCopy copyRegion{};
+            VK_CHECK_RESULT(device->createBuffer(
+                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    staging,
+                    capacity));
+            VK_CHECK_RESULT(staging->map());
 
-            copyRegion.size = vertices.size;
-            vkCmdCopyBuffer(copyCmd, vertexStaging.buffer, vertices.buffer, 1, &copyRegion);
+            VK_CHECK_RESULT(device->createBuffer(
+                    usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    buffer,
+                    capacity));
+        }
 
-            copyRegion.size = indices.size;
-            vkCmdCopyBuffer(copyCmd, indexStaging.buffer, indices.buffer, 1, &copyRegion);
+        // mapped memory the data of a buffer created by allocateBuffer is written to (the buffer itself on unified memory, otherwise its staging buffer)
+        static void *writeTarget(vks::Buffer *buffer, vks::Buffer *staging)
+        {
+            return buffer->mapped ? buffer->mapped : staging->mapped;
+        }
 
-            device->flushCommandBuffer(copyCmd, copyQueue);
+        // finish writing size bytes to the target of writeTarget
+        // returns true if a copy from the staging buffer has to be recorded
+        static bool finishWrite(vks::Buffer *buffer, VkDeviceSize size)
+        {
+            if (buffer->mapped) {
+                // Written in place, no staging copy
+                if ((buffer->memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0) {
+                    buffer->flush();
+                }
+                return false;
+            }
+            return size > 0;
+        }
 
-            // Destroy staging resources
-            vkDestroyBuffer(device->logicalDevice, vertexStaging.buffer, nullptr);
-            vkFreeMemory(device->logicalDevice, vertexStaging.memory, nullptr);
-            vkDestroyBuffer(device->logicalDevice, indexStaging.buffer, nullptr);
-            vkFreeMemory(device->logicalDevice, indexStaging.memory, nullptr);
+        // write data to a buffer created by allocateBuffer
+        // returns true if a copy from the staging buffer has to be recorded
+        static bool writeBuffer(vks::Buffer *buffer, vks::Buffer *staging, const void *data, VkDeviceSize size)
+        {
+            memcpy(writeTarget(buffer, staging), data, size);
+            return finishWrite(buffer, size);
+        }
 
-            return true;
+        // create the vertex and index buffers of the imported mesh, they don't change afterwards
+        // the staging buffers are only needed for the copy and released right after it
+        void uploadMesh(vks::VulkanDevice *device, VkQueue copyQueue)
+        {
+            std::vector<float> &vertexBuffer = model.vertexBuffer;
+            std::vector<uint32_t> &indexBuffer = model.indexBuffer;
+            indexCount = static_cast<uint32_t>(indexBuffer.size());
+
+            // the imported vertices are floats, the vertex buffer holds them in the (possibly packed) layout
+            assert(layout.floatStride() > 0);
+            uint32_t vertexCount = static_cast<uint32_t>(vertexBuffer.size() / layout.floatStride());
+            VkDeviceSize vBufferSize = std::max<VkDeviceSize>(static_cast<VkDeviceSize>(vertexCount) * layout.stride(), 1);
+            // 16 bit indices halve the index buffer and its fetch bandwidth (0xFFFF is left out, it's the restart index)
+            // The indices are relative to the first vertex of their mesh type, so only the largest type has to fit
+            uint32_t typeVertexCount = 0;
+            for (auto& type : model.meshTypes) {
+                typeVertexCount = std::max(typeVertexCount, type.vertexCount);
+            }
+            indexType = (typeVertexCount < 0xFFFF) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+            VkDeviceSize indexSize = (indexType == VK_INDEX_TYPE_UINT16) ? sizeof(uint16_t) : sizeof(uint32_t);
+            VkDeviceSize iBufferSize = std::max<VkDeviceSize>(indexBuffer.size() * indexSize, 1);
+
+            vks::Buffer vertexStaging;
+            vks::Buffer indexStaging;
+            allocateBuffer(device, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vBufferSize, &vertices, &vertexStaging);
+            allocateBuffer(device, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, iBufferSize, &indices, &indexStaging);
+
+            bounds = layout.bounds(vertexBuffer.data(), vertexCount);
+            layout.pack(vertexBuffer.data(), vertexCount, writeTarget(&vertices, &vertexStaging), bounds);
+            bool copyVertices = finishWrite(&vertices, vBufferSize);
+
+            if (indexType == VK_INDEX_TYPE_UINT16) {
+                uint16_t *target = static_cast<uint16_t *>(writeTarget(&indices, &indexStaging));
+                for (size_t i = 0; i < indexBuffer.size(); i++) {
+                    target[i] = static_cast<uint16_t>(indexBuffer[i]);
+                }
+            } else {
+                memcpy(writeTarget(&indices, &indexStaging), indexBuffer.data(), indexBuffer.size() * indexSize);
+            }
+            bool copyIndices = finishWrite(&indices, iBufferSize);
+
+            if (copyVertices || copyIndices) {
+                VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+                VkBufferCopy copyRegion{};
+                if (copyVertices) {
+                    copyRegion.size = vBufferSize;
+                    device->dispatch.CmdCopyBuffer(copyCmd, vertexStaging.buffer, vertices.buffer, 1, &copyRegion);
+                }
+                if (copyIndices) {
+                    copyRegion.size = iBufferSize;
+                    device->dispatch.CmdCopyBuffer(copyCmd, indexStaging.buffer, indices.buffer, 1, &copyRegion);
+                }
+                device->flushCommandBuffer(copyCmd, copyQueue);
+            }
 
+            vertexStaging.destroy();
+            indexStaging.destroy();
         }
 
-        // return true if the vertex buffer is resized, otherwise return false
-        bool updateBuffers(vks::VulkanDevice *device, VkQueue copyQueue){
+        // apply a change of the store (new stream frame, levels of detail): grows or shrinks the instance buffer and splits the buckets into draws
+        // the buffers themselves are written per frame by updateFrame, so this never waits for the frames in flight
+        // return true if the instance buffer has been reallocated, otherwise return false
+        bool updateInstances(vks::VulkanDevice *device){
 
-            std::vector<float> * vertexBuffer;
-            std::vector<uint32_t> * indexBuffer;
+            InstanceStore &store = model.instances;
+            const VkDeviceSize instanceSize = ModelX::instanceFloats * sizeof(float);
+            instanceCount = store.size();
+            VkDeviceSize size = static_cast<VkDeviceSize>(instanceCount) * instanceSize;
 
-            if(model.renderingVerticesCount > 0){
-                vertexBuffer = &model.renderingVertices;
-            }else{
-                vertexBuffer = &model.vertexBuffer;
+            VkDeviceSize capacity = growCapacity(instanceCapacity, size);
+            if (shrinkCapacity(size)) {
+                capacity = growCapacity(0, size * 2);
             }
 
-            if(model.renderingIndicesCount > 0){
-                indexBuffer = &model.renderingIndices;
-                indexCount = model.renderingIndicesCount;
-            }else{
-                indexBuffer = &model.indexBuffer;
-                indexCount = model.indexCount;
+            bool bufferResized = false;
+            if (capacity != instanceCapacity) {
+                // Frames in flight (and their uploads) may still read the old buffers
+                retireBuffers();
+                allocateBuffer(device, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, capacity * frameCount, &instanceData, &instanceStaging);
+                instanceCapacity = capacity;
+                // A new buffer holds none of the instances yet
+                store.markAllDirty();
+                bufferResized = true;
             }
 
-            uint32_t vBufferSize = static_cast<uint32_t>(vertexBuffer->size()) * sizeof(float);
-            uint32_t iBufferSize = static_cast<uint32_t>(indexBuffer->size()) * sizeof(uint32_t);
-
-            // Use staging buffer to move vertex and index buffer to device local memory
-            // Create staging buffers
-            vks::Buffer vertexStaging, indexStaging;
+            updateDrawCommands();
 
-            // Vertex buffer
-            VK_CHECK_RESULT(device->createBuffer(
-                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-                    &vertexStaging,
-                    vBufferSize,
-                    vertexBuffer->data()));
+            return bufferResized;
+        }
 
-            // Index buffer
-            VK_CHECK_RESULT(device->createBuffer(
-                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-                    &indexStaging,
-                    iBufferSize,
-                    indexBuffer->data()));
+        /**
+        * Bring the regions of a frame up to date with the latest instances: writes the instances that changed since the frame's
+        * previous update and its indirect draw commands, the other frames keep drawing from their own regions meanwhile
+        *
+        * @param frame Frame in flight, must have finished executing (see VulkanExampleBase::prepareFrame)
+        * @param copyQueue Queue the staged copies are flushed on if no upload queue is passed
+        * @param uploadQueue (Optional) Upload queue for the staged copies, uses the frame's slot (the frame's graphics submit has to wait on it)
+        *
+        * @return True if instances were written
+        */
+        bool updateFrame(vks::VulkanDevice *device, uint32_t frame, VkQueue copyQueue, vks::UploadQueue *uploadQueue = nullptr){
+            assert(frame < frameCount);
+
+            // Every frame that could draw from the retired buffers has finished once all of them have come back
+            retiringFrames &= ~(1u << frame);
+            if (retiringFrames == 0) {
+                releaseRetiredBuffers();
+            }
 
-            bool bufferResized = false;
+            const VkDeviceSize drawCount = drawCommands.size();
+            memcpy((VkDrawIndexedIndirectCommand*)drawCommand.mapped + frame * drawCount, drawCommands.data(), drawCount * sizeof(VkDrawIndexedIndirectCommand));
+            memcpy((VkDrawIndirectCommand*)impostorDrawCommand.mapped + frame * drawCount, impostorDrawCommands.data(), drawCount * sizeof(VkDrawIndirectCommand));
+
+            InstanceStore &store = model.instances;
+            store.dirtyRanges(dirtyRanges, mergeGap, maxCopyRegions, frame);
+            store.clearDirty(frame);
+
+            const VkDeviceSize instanceSize = ModelX::instanceFloats * sizeof(float);
+            char *target = static_cast<char*>(writeTarget(&instanceData, &instanceStaging));
+            copyRegions.clear();
+            uploadedInstances = 0;
+            for (auto &range : dirtyRanges) {
+                VkBufferCopy copyRegion{};
+                copyRegion.srcOffset = frameOffset(frame) + static_cast<VkDeviceSize>(range.first) * instanceSize;
+                copyRegion.dstOffset = copyRegion.srcOffset;
+                copyRegion.size = static_cast<VkDeviceSize>(range.count) * instanceSize;
+                memcpy(target + copyRegion.dstOffset, store.data.data() + range.first * ModelX::instanceFloats, copyRegion.size);
+                copyRegions.push_back(copyRegion);
+                uploadedInstances += range.count;
+            }
+            if (!finishWrite(&instanceData, uploadedInstances * instanceSize)) {
+                return uploadedInstances > 0;
+            }
 
-            if(currentVBufferSize != vBufferSize){
-                bufferResized = true;
-                // destroy the old buffer
-                vertices.destroy();
-                indices.destroy();
-                // Create device local target buffers
-                // Vertex buffer
-                VK_CHECK_RESULT(device->createBuffer(
-                        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                        &vertices,
-                        vBufferSize));
-
-                // Index buffer
-                VK_CHECK_RESULT(device->createBuffer(
-                        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                        &indices,
-                        iBufferSize));
-                currentVBufferSize = vBufferSize;
+            if (uploadQueue) {
+                // The frame's slot, its last upload was waited on by the frame that just finished
+                uploadQueue->begin(frame);
+                uploadQueue->copy(&instanceStaging, &instanceData, static_cast<uint32_t>(copyRegions.size()), copyRegions.data(), VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+                uploadQueue->submit();
+            } else {
+                // Copy the dirty parts of the frame's staging region
+                VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+                device->dispatch.CmdCopyBuffer(copyCmd, instanceStaging.buffer, instanceData.buffer, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+                device->flushCommandBuffer(copyCmd, copyQueue);
             }
+            return true;
+        }
 
-            // Copy from staging buffers
-            VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-                                                                  true);
+        // keep the instance and staging buffers until every frame has been updated from their replacements
+        void retireBuffers()
+        {
+            if (instanceData.buffer != VK_NULL_HANDLE) {
+                retiredBuffers.push_back(instanceData);
+                instanceData = vks::Buffer();
+            }
+            if (instanceStaging.buffer != VK_NULL_HANDLE) {
+                retiredBuffers.push_back(instanceStaging);
+                instanceStaging = vks::Buffer();
+            }
+            retiringFrames = (1u << frameCount) - 1;
+        }
 
-            VkBufferCopy copyRegion{};
+        void releaseRetiredBuffers()
+        {
+            for (auto &buffer : retiredBuffers) {
+                buffer.destroy();
+            }
+            retiredBuffers.clear();
+            retiringFrames = 0;
+        }
 
-            copyRegion.size = vertices.size;
-            vkCmdCopyBuffer(copyCmd, vertexStaging.buffer, vertices.buffer, 1, &copyRegion);
+        // index of the draw of a group of a bucket's instances in the indirect buffers, drawFirstInstance and drawInstanceCount
+        // the draws of a group are consecutive
+        uint32_t drawIndex(uint32_t bucket, uint32_t group) const
+        {
+            return group * model.bucketCount() + bucket;
+        }
 
-            copyRegion.size = indices.size;
-            vkCmdCopyBuffer(copyCmd, indexStaging.buffer, indices.buffer, 1, &copyRegion);
+        // split the instances of each bucket into drawGroupCount ranges, the instance counts are read from the indirect buffer at execution time
+        // trailing groups may be empty, the commands are copied to the indirect buffers by updateFrame
+        void updateDrawCommands()
+        {
+            VkDrawIndexedIndirectCommand *drawCmd = drawCommands.data();
+            VkDrawIndirectCommand *impostorCmd = impostorDrawCommands.data();
+            for (uint32_t bucket = 0; bucket < model.bucketCount(); bucket++) {
+                InstanceRange range = model.instances.bucketRange(bucket);
+                const ModelX::MeshType &type = model.meshTypes[model.typeOfBucket(bucket)];
+                const bool mesh = model.isMeshBucket(bucket);
+                uint32_t groupInstanceCount = (range.count + drawGroupCount - 1) / drawGroupCount;
+                for (uint32_t i = 0; i < drawGroupCount; i++) {
+                    uint32_t draw = drawIndex(bucket, i);
+                    uint32_t first = std::min(i * groupInstanceCount, range.count);
+                    uint32_t count = std::min(groupInstanceCount, range.count - first);
+                    // Without the drawIndirectFirstInstance feature a non-zero first instance is invalid, the draws offset the binding instead
+                    // Empty draws bind the start of the buffer, an offset at the end of the buffer would be out of range
+                    uint32_t firstInstance = (count > 0) ? range.first + first : 0;
+                    drawCmd[draw].indexCount = mesh ? type.lods[model.levelOfBucket(bucket)].indexCount : 0;
+                    drawCmd[draw].instanceCount = mesh ? count : 0;
+                    drawCmd[draw].firstIndex = mesh ? type.lods[model.levelOfBucket(bucket)].firstIndex : 0;
+                    drawCmd[draw].vertexOffset = static_cast<int32_t>(type.vertexBase);
+                    drawCmd[draw].firstInstance = useFirstInstance ? firstInstance : 0;
+                    impostorCmd[draw].vertexCount = 4;
+                    impostorCmd[draw].instanceCount = count;
+                    impostorCmd[draw].firstVertex = 0;
+                    impostorCmd[draw].firstInstance = useFirstInstance ? firstInstance : 0;
+                    drawFirstInstance[draw] = useFirstInstance ? 0 : firstInstance;
+                    drawInstanceCount[draw] = count;
+                }
+            }
+        }
 
-            device->flushCommandBuffer(copyCmd, copyQueue);
+        // offset of a frame's region in the instance buffer, the first instance of the draws is relative to it
+        VkDeviceSize frameOffset(uint32_t frame) const
+        {
+            return frame * instanceCapacity;
+        }
 
-            // Destroy staging resources
-            vkDestroyBuffer(device->logicalDevice, vertexStaging.buffer, nullptr);
-            vkFreeMemory(device->logicalDevice, vertexStaging.memory, nullptr);
-            vkDestroyBuffer(device->logicalDevice, indexStaging.buffer, nullptr);
-            vkFreeMemory(device->logicalDevice, indexStaging.memory, nullptr);
+        // offset of a draw's instances in the instance buffer for a frame, to be used when binding it
+        VkDeviceSize instanceOffset(uint32_t bucket, uint32_t group, uint32_t frame) const
+        {
+            return frameOffset(frame) + static_cast<VkDeviceSize>(drawFirstInstance[drawIndex(bucket, group)]) * ModelX::instanceFloats * sizeof(float);
+        }
 
-            return bufferResized;
+        // offsets of a draw's commands in the indirect buffers for a frame
+        VkDeviceSize drawCommandOffset(uint32_t draw, uint32_t frame) const
+        {
+            return (static_cast<VkDeviceSize>(frame) * drawCommands.size() + draw) * sizeof(VkDrawIndexedIndirectCommand);
         }
 
-        // return true if vertex buffer is resized, otherwise return false
-		bool updateVertexBuffer(vks::VulkanDevice *device, VkQueue copyQueue){
-            // update the rendering data according to the configure data from server
-            model.loadFromServer();
-            if(model.isDataChanged){
-                // data has changed, update the vertex buffer
-                return updateBuffers(device, copyQueue);
-            }
-            return false;
-		}
+        VkDeviceSize impostorDrawCommandOffset(uint32_t draw, uint32_t frame) const
+        {
+            return (static_cast<VkDeviceSize>(frame) * impostorDrawCommands.size() + draw) * sizeof(VkDrawIndirectCommand);
+        }
 
 		void setObjectsMultiple(int multiple){
 //			MULTIPLE = multiple;
 		}
 	};
-};
\ No newline at end of file
+};
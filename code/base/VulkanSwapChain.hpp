@@ -84,7 +84,8 @@ public:
 	/** @brief Queue family index of the detected graphics and presenting device queue */
 	uint32_t queueNodeIndex = UINT32_MAX;
 
-	// Creates an os specific surface
+#if !defined(_HEADLESS)
+	// Creates an os specific surface (not available in headless mode, it renders offscreen)
 	/**
 	* Create the surface object, an abstraction for the native platform window
 	*
@@ -265,6 +266,7 @@ public:
 		}
 
 	}
+#endif
 
 	/**
 	* Set instance, physical and logical device to use for the swapchain and get all required function pointers
@@ -45,6 +45,15 @@
 */ 
 class VulkanTextOverlay
 {
+public:
+	/** @brief How the overlay gets into the frame */
+	enum RenderMode {
+		/** @brief Drawn by the application inside its own render pass after the scene (see draw), the frame needs a single submit */
+		renderModeInline,
+		/** @brief Drawn in a separate render pass that loads the color attachment, submitted after the scene (legacy) */
+		renderModeSeparatePass
+	};
+
 private:
 	vks::VulkanDevice *vulkanDevice;
 
@@ -58,8 +67,13 @@ private:
 	VkSampler sampler;
 	VkImage image;
 	VkImageView view;
+	/** @brief One slice of vertices per frame buffer, so the text of a frame can change while other frames are in flight */
 	vks::Buffer vertexBuffer;
-	VkDeviceMemory imageMemory;
+	/** @brief Static quad indices for MAX_CHAR_COUNT letters */
+	vks::Buffer indexBuffer;
+	/** @brief Indirect draw parameters per frame buffer, so text changes don't require re-recording command buffers */
+	vks::Buffer drawCommand;
+	vks::Allocation imageAllocation;
 	VkDescriptorPool descriptorPool;
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkDescriptorSet descriptorSet;
@@ -72,16 +86,28 @@ private:
 	std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
 	VkFence fence;
 
-	// Used during text updates
-	glm::vec4 *mappedLocal = nullptr;
+	// Text vertices generated by the current update and the ones in the vertex buffer
+	std::vector<glm::vec4> vertices;
+	std::vector<glm::vec4> bufferedVertices;
+	bool bufferedVisible = true;
+	// Slices that still hold an older text, rewritten by updateFrame once their frame has finished
+	std::vector<bool> staleSlices;
 
 	stb_fontchar stbFontData[STB_NUM_CHARS];
-	uint32_t numLetters;
+	uint32_t numLetters = 0;
+
+	// Bytes of the vertex buffer per frame buffer
+	static VkDeviceSize sliceSize()
+	{
+		return MAX_CHAR_COUNT * 4 * sizeof(glm::vec4);
+	}
 
 public:
 
 	enum TextAlign { alignLeft, alignCenter, alignRight };
 
+	RenderMode renderMode;
+
 	bool visible = true;
 	bool invalidated = false;
 
@@ -93,6 +119,7 @@ public:
 	* Default constructor
 	*
 	* @param vulkanDevice Pointer to a valid VulkanDevice
+	* @param renderMode (Optional) Draw inside the application's render pass or in a separate one
 	*/
 	VulkanTextOverlay(
 		vks::VulkanDevice *vulkanDevice,
@@ -102,10 +129,12 @@ public:
 		VkFormat depthformat,
 		uint32_t *framebufferwidth,
 		uint32_t *framebufferheight,
-		std::vector<VkPipelineShaderStageCreateInfo> shaderstages)
+		std::vector<VkPipelineShaderStageCreateInfo> shaderstages,
+		RenderMode renderMode = renderModeInline)
 	{
 		this->vulkanDevice = vulkanDevice;
 		this->queue = queue;
+		this->renderMode = renderMode;
 		this->colorFormat = colorformat;
 		this->depthFormat = depthformat;
 
@@ -140,6 +169,10 @@ public:
 		prepareResources();
 		prepareRenderPass();
 		preparePipeline();
+		if (renderMode == renderModeSeparatePass)
+		{
+			updateCommandBuffers();
+		}
 	}
 
 	/**
@@ -149,10 +182,12 @@ public:
 	{
 		// Free up all Vulkan resources requested by the text overlay
 		vertexBuffer.destroy();
+		indexBuffer.destroy();
+		drawCommand.destroy();
 		vkDestroySampler(vulkanDevice->logicalDevice, sampler, nullptr);
 		vkDestroyImage(vulkanDevice->logicalDevice, image, nullptr);
 		vkDestroyImageView(vulkanDevice->logicalDevice, view, nullptr);
-		vkFreeMemory(vulkanDevice->logicalDevice, imageMemory, nullptr);
+		vulkanDevice->memoryAllocator->free(&imageAllocation);
 		vkDestroyDescriptorSetLayout(vulkanDevice->logicalDevice, descriptorSetLayout, nullptr);
 		vkDestroyDescriptorPool(vulkanDevice->logicalDevice, descriptorPool, nullptr);
 		vkDestroyPipelineLayout(vulkanDevice->logicalDevice, pipelineLayout, nullptr);
@@ -190,16 +225,49 @@ public:
 
 		VK_CHECK_RESULT(vkAllocateCommandBuffers(vulkanDevice->logicalDevice, &cmdBufAllocateInfo, cmdBuffers.data()));
 
-		// Vertex buffer
+		// Vertex buffer, 4 vertices per letter for each frame buffer
 		VK_CHECK_RESULT(vulkanDevice->createBuffer(
 			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 			&vertexBuffer,
-			MAX_CHAR_COUNT * sizeof(glm::vec4)));
+			cmdBuffers.size() * sliceSize()));
+		staleSlices.assign(cmdBuffers.size(), false);
 
 		// Map persistent
 		vertexBuffer.map();
 
+		// Index buffer, every letter is a quad made of two triangles
+		std::vector<uint16_t> quadIndices(MAX_CHAR_COUNT * 6);
+		for (uint32_t i = 0; i < MAX_CHAR_COUNT; i++)
+		{
+			const uint16_t base = static_cast<uint16_t>(i * 4);
+			// Same triangles (and winding) as a four vertex strip
+			quadIndices[i * 6 + 0] = base + 0;
+			quadIndices[i * 6 + 1] = base + 1;
+			quadIndices[i * 6 + 2] = base + 2;
+			quadIndices[i * 6 + 3] = base + 1;
+			quadIndices[i * 6 + 4] = base + 3;
+			quadIndices[i * 6 + 5] = base + 2;
+		}
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&indexBuffer,
+			quadIndices.size() * sizeof(uint16_t),
+			quadIndices.data()));
+
+		// Indirect draw commands, the index count is updated with the text
+		VkDrawIndexedIndirectCommand emptyDraw = {};
+		emptyDraw.instanceCount = 1;
+		std::vector<VkDrawIndexedIndirectCommand> emptyDraws(cmdBuffers.size(), emptyDraw);
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&drawCommand,
+			emptyDraws.size() * sizeof(VkDrawIndexedIndirectCommand),
+			emptyDraws.data()));
+		drawCommand.map();
+
 		// Font texture
 		VkImageCreateInfo imageInfo = vks::initializers::imageCreateInfo();
 		imageInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -216,13 +284,7 @@ public:
 		imageInfo.initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;
 		VK_CHECK_RESULT(vkCreateImage(vulkanDevice->logicalDevice, &imageInfo, nullptr, &image));
 
-		VkMemoryRequirements memReqs;
-		VkMemoryAllocateInfo allocInfo = vks::initializers::memoryAllocateInfo();
-		vkGetImageMemoryRequirements(vulkanDevice->logicalDevice, image, &memReqs);
-		allocInfo.allocationSize = memReqs.size;
-		allocInfo.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(vulkanDevice->logicalDevice, &allocInfo, nullptr, &imageMemory));
-		VK_CHECK_RESULT(vkBindImageMemory(vulkanDevice->logicalDevice, image, imageMemory, 0));
+		VK_CHECK_RESULT(vulkanDevice->allocateImageMemory(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &imageAllocation));
 
 		// Staging
 		vks::Buffer stagingBuffer;
@@ -231,7 +293,9 @@ public:
 			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 			&stagingBuffer,
-			allocInfo.allocationSize));
+			imageAllocation.size,
+			nullptr,
+			vks::ALLOCATION_STRATEGY_LINEAR));
 
 		stagingBuffer.map();
 		memcpy(stagingBuffer.mapped, &font24pixels[0][0], STB_FONT_WIDTH * STB_FONT_HEIGHT);	// Only one channel, so data size = W * H (*R8)
@@ -284,8 +348,8 @@ public:
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &copyCmd;
 
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
-		VK_CHECK_RESULT(vkQueueWaitIdle(queue));
+		VK_CHECK_RESULT(vulkanDevice->dispatch.QueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+		VK_CHECK_RESULT(vulkanDevice->dispatch.QueueWaitIdle(queue));
 
 		stagingBuffer.destroy();
 
@@ -382,7 +446,7 @@ public:
 	{
 		VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
 			vks::initializers::pipelineInputAssemblyStateCreateInfo(
-				VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+				VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
 				0,
 				VK_FALSE);
 
@@ -553,12 +617,11 @@ public:
 	}
 
 	/**
-	* Maps the buffer, resets letter count
+	* Starts building new text, the vertex buffer keeps the current text until endTextUpdate
 	*/
 	void beginTextUpdate()
 	{
-		mappedLocal = (glm::vec4*)vertexBuffer.mapped;
-		numLetters = 0;
+		vertices.clear();
 	}
 
 	/**
@@ -571,8 +634,6 @@ public:
 	*/
 	void addText(std::string text, float x, float y, TextAlign align)
 	{
-		assert(vertexBuffer.mapped != nullptr);
-
 		if (align == alignLeft) {
 			x *= scale;
 		};
@@ -610,51 +671,106 @@ public:
 		// Generate a uv mapped quad per char in the new text
 		for (auto letter : text)
 		{
+			if (vertices.size() >= MAX_CHAR_COUNT * 4)
+			{
+				break;
+			}
+
 			stb_fontchar *charData = &stbFontData[(uint32_t)letter - STB_FIRST_CHAR];
 
-			mappedLocal->x = (x + (float)charData->x0 * charW);
-			mappedLocal->y = (y + (float)charData->y0 * charH);
-			mappedLocal->z = charData->s0;
-			mappedLocal->w = charData->t0;
-			mappedLocal++;
-
-			mappedLocal->x = (x + (float)charData->x1 * charW);
-			mappedLocal->y = (y + (float)charData->y0 * charH);
-			mappedLocal->z = charData->s1;
-			mappedLocal->w = charData->t0;
-			mappedLocal++;
-
-			mappedLocal->x = (x + (float)charData->x0 * charW);
-			mappedLocal->y = (y + (float)charData->y1 * charH);
-			mappedLocal->z = charData->s0;
-			mappedLocal->w = charData->t1;
-			mappedLocal++;
-
-			mappedLocal->x = (x + (float)charData->x1 * charW);
-			mappedLocal->y = (y + (float)charData->y1 * charH);
-			mappedLocal->z = charData->s1;
-			mappedLocal->w = charData->t1;
-			mappedLocal++;
+			vertices.push_back(glm::vec4(x + (float)charData->x0 * charW, y + (float)charData->y0 * charH, charData->s0, charData->t0));
+			vertices.push_back(glm::vec4(x + (float)charData->x1 * charW, y + (float)charData->y0 * charH, charData->s1, charData->t0));
+			vertices.push_back(glm::vec4(x + (float)charData->x0 * charW, y + (float)charData->y1 * charH, charData->s0, charData->t1));
+			vertices.push_back(glm::vec4(x + (float)charData->x1 * charW, y + (float)charData->y1 * charH, charData->s1, charData->t1));
 
 			x += charData->advance * charW;
+		}
+	}
+
+	/**
+	* Check if the text (or visibility) built since beginTextUpdate differs from what is currently drawn
+	*/
+	bool textChanged() const
+	{
+		return (vertices != bufferedVertices) || (visible != bufferedVisible);
+	}
+
+	/**
+	* Take the new text, if it changed
+	*
+	* @note Nothing is written to the buffers here, so frames in flight are not affected. The slice of each frame buffer
+	* is rewritten by updateFrame before the next frame using it is submitted.
+	*
+	* @return True if the text changed
+	*/
+	bool endTextUpdate()
+	{
+		if (!textChanged())
+		{
+			return false;
+		}
+
+		numLetters = static_cast<uint32_t>(vertices.size() / 4);
+		bufferedVertices.swap(vertices);
+		bufferedVisible = visible;
+		staleSlices.assign(staleSlices.size(), true);
+		return true;
+	}
 
-			numLetters++;
+	/**
+	* Write the current text to the slice of a frame buffer, if it holds an older one
+	*
+	* @param frame Index of the frame buffer, the last frame drawn to it must have finished
+	*/
+	void updateFrame(uint32_t frame)
+	{
+		if (!staleSlices[frame])
+		{
+			return;
 		}
+		if (!bufferedVertices.empty())
+		{
+			memcpy((char*)vertexBuffer.mapped + frame * sliceSize(), bufferedVertices.data(), bufferedVertices.size() * sizeof(glm::vec4));
+		}
+		// The recorded command buffers read the index count at execution time
+		VkDrawIndexedIndirectCommand *drawCmd = (VkDrawIndexedIndirectCommand*)drawCommand.mapped + frame;
+		drawCmd->indexCount = bufferedVisible ? numLetters * 6 : 0;
+		staleSlices[frame] = false;
 	}
 
 	/**
-	* Unmap buffer and update command buffers
+	* Record the overlay draw into a command buffer inside a render pass compatible with the overlay's render pass
+	*
+	* @param commandBuffer Command buffer to record to, the scene must have been drawn before
+	* @param frame Index of the frame buffer the command buffer draws to (selects the slice of the text)
 	*/
-	void endTextUpdate()
+	void draw(VkCommandBuffer commandBuffer, uint32_t frame)
 	{
-		updateCommandBuffers();
+		const vks::DeviceDispatch &vk = vulkanDevice->dispatch;
+		VkViewport viewport = vks::initializers::viewport((float)*frameBufferWidth, (float)*frameBufferHeight, 0.0f, 1.0f);
+		vk.CmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+		VkRect2D scissor = vks::initializers::rect2D(*frameBufferWidth, *frameBufferHeight, 0, 0);
+		vk.CmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		vk.CmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		vk.CmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+
+		VkDeviceSize offsets = frame * sliceSize();
+		vk.CmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer.buffer, &offsets);
+		vk.CmdBindVertexBuffers(commandBuffer, 1, 1, &vertexBuffer.buffer, &offsets);
+		vk.CmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
+
+		vk.CmdDrawIndexedIndirect(commandBuffer, drawCommand.buffer, frame * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
 	}
 
 	/**
-	* Update the command buffers to reflect text changes
+	* Record the command buffers of the separate overlay render pass (renderModeSeparatePass only)
+	* @note Only required when the frame buffers change, text changes are picked up through the indirect draw
 	*/
 	void updateCommandBuffers()
 	{
+		const vks::DeviceDispatch &vk = vulkanDevice->dispatch;
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
 		VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
@@ -669,40 +785,25 @@ public:
 		{
 			renderPassBeginInfo.framebuffer = *frameBuffers[i];
 
-			VK_CHECK_RESULT(vkBeginCommandBuffer(cmdBuffers[i], &cmdBufInfo));
+			VK_CHECK_RESULT(vk.BeginCommandBuffer(cmdBuffers[i], &cmdBufInfo));
 
 			if (vks::debugmarker::active)
 			{
 				vks::debugmarker::beginRegion(cmdBuffers[i], "Text overlay", glm::vec4(1.0f, 0.94f, 0.3f, 1.0f));
 			}
 
-			vkCmdBeginRenderPass(cmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+			vk.CmdBeginRenderPass(cmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-			VkViewport viewport = vks::initializers::viewport((float)*frameBufferWidth, (float)*frameBufferHeight, 0.0f, 1.0f);
-			vkCmdSetViewport(cmdBuffers[i], 0, 1, &viewport);
+			draw(cmdBuffers[i], i);
 
-			VkRect2D scissor = vks::initializers::rect2D(*frameBufferWidth, *frameBufferHeight, 0, 0);
-			vkCmdSetScissor(cmdBuffers[i], 0, 1, &scissor);
-			
-			vkCmdBindPipeline(cmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-			vkCmdBindDescriptorSets(cmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
-
-			VkDeviceSize offsets = 0;
-			vkCmdBindVertexBuffers(cmdBuffers[i], 0, 1, &vertexBuffer.buffer, &offsets);
-			vkCmdBindVertexBuffers(cmdBuffers[i], 1, 1, &vertexBuffer.buffer, &offsets);
-			for (uint32_t j = 0; j < numLetters; j++)
-			{
-				vkCmdDraw(cmdBuffers[i], 4, 1, j * 4, 0);
-			}
-
-			vkCmdEndRenderPass(cmdBuffers[i]);
+			vk.CmdEndRenderPass(cmdBuffers[i]);
 
 			if (vks::debugmarker::active)
 			{
 				vks::debugmarker::endRegion(cmdBuffers[i]);
 			}
 
-			VK_CHECK_RESULT(vkEndCommandBuffer(cmdBuffers[i]));
+			VK_CHECK_RESULT(vk.EndCommandBuffer(cmdBuffers[i]));
 		}
 	}
 
@@ -711,6 +812,7 @@ public:
 	*/
 	void submit(VkQueue queue, uint32_t bufferindex, VkSubmitInfo submitInfo)
 	{
+		const vks::DeviceDispatch &vk = vulkanDevice->dispatch;
 		if (!visible)
 		{
 			return;
@@ -719,14 +821,14 @@ public:
 		submitInfo.pCommandBuffers = &cmdBuffers[bufferindex];
 		submitInfo.commandBufferCount = 1;
 
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
+		VK_CHECK_RESULT(vk.QueueSubmit(queue, 1, &submitInfo, fence));
 
-		VK_CHECK_RESULT(vkWaitForFences(vulkanDevice->logicalDevice, 1, &fence, VK_TRUE, UINT64_MAX));
-		VK_CHECK_RESULT(vkResetFences(vulkanDevice->logicalDevice, 1, &fence));
+		VK_CHECK_RESULT(vk.WaitForFences(vulkanDevice->logicalDevice, 1, &fence, VK_TRUE, UINT64_MAX));
+		VK_CHECK_RESULT(vk.ResetFences(vulkanDevice->logicalDevice, 1, &fence));
 	}
 
 	/**
-	* Reallocate command buffers for the text overlay
+	* Reallocate (and re-record) command buffers for the text overlay
 	* @note Frees the existing command buffers
 	*/
 	void reallocateCommandBuffers()
@@ -740,6 +842,11 @@ public:
 				static_cast<uint32_t>(cmdBuffers.size()));
 
 		VK_CHECK_RESULT(vkAllocateCommandBuffers(vulkanDevice->logicalDevice, &cmdBufAllocateInfo, cmdBuffers.data()));
+
+		if (renderMode == renderModeSeparatePass)
+		{
+			updateCommandBuffers();
+		}
 	}
 
 };
\ No newline at end of file
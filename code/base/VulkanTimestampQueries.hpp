@@ -0,0 +1,172 @@
+/*
+* GPU timestamp queries
+*
+* Measures GPU execution time between timestamps written into command buffers,
+* results are read back without waiting once the commands are known to have finished
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <assert.h>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanDevice.hpp"
+
+namespace vks
+{
+	/**
+	* @brief Timestamp query pool split into slots (e.g. one per frame in flight)
+	*
+	* Each slot holds a fixed number of timestamps that are reset together. A slot is reset and written
+	* while recording, and its results are collected once the work that wrote it has finished (e.g. after
+	* waiting on the frame's fence), so reading them never blocks.
+	*/
+	class TimestampQueries
+	{
+	private:
+		vks::VulkanDevice *device;
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		uint32_t slotCount = 0;
+		uint32_t timestampsPerSlot = 0;
+		/** @brief Mask of the valid bits of the queue family's timestamps */
+		uint64_t validMask = 0;
+		/** @brief True if the slot has been reset and written since its results were last collected */
+		std::vector<bool> recorded;
+		/** @brief Collected timestamps of all slots */
+		std::vector<uint64_t> results;
+
+	public:
+		/** @brief Nanoseconds per timestamp tick */
+		float timestampPeriod = 0.0f;
+
+		/**
+		* Create the query pool, if the queue family supports timestamps
+		*
+		* @param device Pointer to the Vulkan device
+		* @param queueFamilyIndex Family of the queue the timestamps are written on
+		* @param slotCount Number of slots that can be in flight at the same time
+		* @param timestampsPerSlot Number of timestamps per slot
+		*/
+		TimestampQueries(vks::VulkanDevice *device, uint32_t queueFamilyIndex, uint32_t slotCount, uint32_t timestampsPerSlot)
+		{
+			this->device = device;
+			this->slotCount = slotCount;
+			this->timestampsPerSlot = timestampsPerSlot;
+			timestampPeriod = device->properties.limits.timestampPeriod;
+
+			const VkQueueFamilyProperties &family = device->queueFamilyProperties[queueFamilyIndex];
+			uint32_t validBits = family.timestampValidBits;
+			// vkCmdResetQueryPool needs a graphics or compute queue (Vulkan 1.0 has no host reset), so a pure transfer family can't reuse the queries
+			bool canReset = (family.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) != 0;
+			if (validBits == 0 || timestampPeriod <= 0.0f || !canReset)
+			{
+				// Timestamps are not supported on this queue family, all calls become no-ops
+				return;
+			}
+			validMask = (validBits >= 64) ? ~0ULL : ((1ULL << validBits) - 1);
+
+			VkQueryPoolCreateInfo queryPoolInfo = {};
+			queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			queryPoolInfo.queryCount = slotCount * timestampsPerSlot;
+			VK_CHECK_RESULT(vkCreateQueryPool(device->logicalDevice, &queryPoolInfo, nullptr, &queryPool));
+
+			recorded.resize(slotCount, false);
+			results.resize(slotCount * timestampsPerSlot, 0);
+		}
+
+		~TimestampQueries()
+		{
+			if (queryPool)
+			{
+				vkDestroyQueryPool(device->logicalDevice, queryPool, nullptr);
+			}
+		}
+
+		/** @brief True if the queue family supports timestamps */
+		bool supported() const
+		{
+			return queryPool != VK_NULL_HANDLE;
+		}
+
+		/**
+		* Record the reset of all timestamps of a slot (must be recorded outside of a render pass, before the slot is written)
+		*/
+		void reset(VkCommandBuffer commandBuffer, uint32_t slot)
+		{
+			if (!supported())
+			{
+				return;
+			}
+			assert(slot < slotCount);
+			device->dispatch.CmdResetQueryPool(commandBuffer, queryPool, slot * timestampsPerSlot, timestampsPerSlot);
+			recorded[slot] = true;
+		}
+
+		/**
+		* Record a timestamp of a slot
+		*
+		* @param stage Pipeline stage at which the timestamp is written (e.g. TOP_OF_PIPE before and BOTTOM_OF_PIPE after the measured commands)
+		*/
+		void write(VkCommandBuffer commandBuffer, uint32_t slot, uint32_t index, VkPipelineStageFlagBits stage)
+		{
+			if (!supported())
+			{
+				return;
+			}
+			assert(slot < slotCount && index < timestampsPerSlot);
+			device->dispatch.CmdWriteTimestamp(commandBuffer, stage, queryPool, slot * timestampsPerSlot + index);
+		}
+
+		/**
+		* Read back the timestamps of a slot without waiting
+		*
+		* @return True if all timestamps of the slot were available (they stay valid until the next collect of the slot)
+		*
+		* @note The work that wrote the slot should have finished, otherwise the results are not available yet
+		*/
+		bool collect(uint32_t slot)
+		{
+			if (!supported() || !recorded[slot])
+			{
+				return false;
+			}
+			VkResult result = device->dispatch.GetQueryPoolResults(
+				device->logicalDevice,
+				queryPool,
+				slot * timestampsPerSlot,
+				timestampsPerSlot,
+				timestampsPerSlot * sizeof(uint64_t),
+				&results[slot * timestampsPerSlot],
+				sizeof(uint64_t),
+				VK_QUERY_RESULT_64_BIT);
+			if (result != VK_SUCCESS)
+			{
+				// VK_NOT_READY, try again later
+				return false;
+			}
+			recorded[slot] = false;
+			return true;
+		}
+
+		/**
+		* Get the time between two collected timestamps of a slot in milliseconds
+		*/
+		double elapsed(uint32_t slot, uint32_t begin, uint32_t end) const
+		{
+			if (!supported())
+			{
+				return 0.0;
+			}
+			uint64_t t0 = results[slot * timestampsPerSlot + begin] & validMask;
+			uint64_t t1 = results[slot * timestampsPerSlot + end] & validMask;
+			// Handle a wrap around of the valid bits
+			uint64_t ticks = (t1 - t0) & validMask;
+			return static_cast<double>(ticks) * timestampPeriod / 1000000.0;
+		}
+	};
+}
@@ -286,6 +286,25 @@ namespace vks
 			return fileContent;
 		}
 
+#if defined(__ANDROID__)
+		bool fileExists(AAssetManager* assetManager, const char *fileName)
+		{
+			AAsset* asset = AAssetManager_open(assetManager, fileName, AASSET_MODE_STREAMING);
+			if (!asset)
+			{
+				return false;
+			}
+			AAsset_close(asset);
+			return true;
+		}
+#else
+		bool fileExists(const char *fileName)
+		{
+			std::ifstream is(fileName, std::ios::binary | std::ios::in);
+			return is.is_open();
+		}
+#endif
+
 #if defined(__ANDROID__)
 		// Android shaders are stored as assets in the apk
 		// So they need to be loaded via the asset manager
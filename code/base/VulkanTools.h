@@ -60,10 +60,21 @@
 
 #if defined(__ANDROID__)
 #define ASSET_PATH ""
+#elif defined(_HEADLESS)
+// Headless host builds read the Android app's assets in place (relative to the code directory)
+#define ASSET_PATH "./../holostage/app/src/main/assets/"
 #else
 #define ASSET_PATH "./../data/"
 #endif
 
+#if !defined(__ANDROID__)
+// Shared code logs with the Android macros, other platforms write to the console
+#define LOGI(...) ((void)printf(__VA_ARGS__), (void)printf("\n"))
+#define LOGW(...) ((void)fprintf(stderr, __VA_ARGS__), (void)fprintf(stderr, "\n"))
+#define LOGD(...) ((void)printf(__VA_ARGS__), (void)printf("\n"))
+#define LOGE(...) ((void)fprintf(stderr, __VA_ARGS__), (void)fprintf(stderr, "\n"))
+#endif
+
 namespace vks
 {
 	namespace tools
@@ -113,6 +124,13 @@ namespace vks
 		// Display error message and exit on fatal error
 		void exitFatal(std::string message, std::string caption);
 
+		// Check if a file exists (an asset of the apk on Android)
+#if defined(__ANDROID__)
+		bool fileExists(AAssetManager* assetManager, const char *fileName);
+#else
+		bool fileExists(const char *fileName);
+#endif
+
 		// Load a SPIR-V shader (binary) 
 #if defined(__ANDROID__)
 		VkShaderModule loadShader(AAssetManager* assetManager, const char *fileName, VkDevice device, VkShaderStageFlagBits stage);
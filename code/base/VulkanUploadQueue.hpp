@@ -0,0 +1,363 @@
+/*
+* Vulkan upload queue
+*
+* Records buffer copies on a transfer queue and hands them over to the graphics queue
+* without stalling the host
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <assert.h>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+#include "VulkanTimestampQueries.hpp"
+
+namespace vks
+{
+	/**
+	* @brief Asynchronous buffer uploads on a (dedicated) transfer queue
+	*
+	* Copies are recorded between begin and submit and executed on the transfer queue. If the transfer queue
+	* is from a different family than the graphics queue, the ownership of the destination buffers is released
+	* after the copies and acquired on the graphics queue.
+	* The graphics submission that first uses the uploaded data has to wait on the semaphore returned by takeWaitSemaphore.
+	* Uploads go into slots (e.g. one per frame in flight), a slot is only reused once the submission that waited on its last upload has finished.
+	*/
+	class UploadQueue
+	{
+	private:
+		/** @brief Resources of a single upload */
+		struct Slot
+		{
+			/** @brief Copy and release commands, recorded on the transfer family */
+			VkCommandBuffer copyCmd = VK_NULL_HANDLE;
+			/** @brief Ownership acquire commands, recorded on the graphics family */
+			VkCommandBuffer acquireCmd = VK_NULL_HANDLE;
+			/** @brief Signaled by the transfer submission */
+			VkSemaphore transferComplete = VK_NULL_HANDLE;
+			/** @brief Signaled by the acquire submission (only used with different queue families) */
+			VkSemaphore acquireComplete = VK_NULL_HANDLE;
+			/** @brief Signaled once all commands of the slot have finished executing */
+			VkFence fence = VK_NULL_HANDLE;
+			bool submitted = false;
+		};
+
+		vks::VulkanDevice *device;
+		VkQueue transferQueue;
+		VkQueue graphicsQueue;
+		VkCommandPool transferPool = VK_NULL_HANDLE;
+		VkCommandPool graphicsPool = VK_NULL_HANDLE;
+		std::vector<Slot> slots;
+		uint32_t current = 0;
+		bool recording = false;
+
+		/** @brief Buffers written by the current upload, their ownership is transferred on submit */
+		std::vector<VkBufferMemoryBarrier> ownershipBarriers;
+		/** @brief Non-empty regions of the copy being recorded (kept to avoid an allocation per copy) */
+		std::vector<VkBufferCopy> copyRegions;
+
+		/** @brief Semaphore the next graphics submission has to wait on */
+		VkSemaphore pendingSemaphore = VK_NULL_HANDLE;
+
+		/** @brief Start and end timestamp of each slot's copies */
+		vks::TimestampQueries *timestamps = nullptr;
+
+		/** @brief Read back the GPU time of the last upload of a finished slot */
+		void collectTimings(uint32_t slot)
+		{
+			if (timestamps->collect(slot))
+			{
+				lastUploadTime = timestamps->elapsed(slot, 0, 1);
+			}
+		}
+
+		bool ownershipTransfer() const
+		{
+			return device->queueFamilyIndices.transfer != device->queueFamilyIndices.graphics;
+		}
+
+	public:
+		/** @brief Pipeline stage at which the graphics submission waits for the upload */
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+
+		/** @brief GPU time of the copies of the last finished upload in milliseconds (0 if the transfer family has no timestamps, e.g. a dedicated transfer family) */
+		double lastUploadTime = 0.0;
+
+		/**
+		* Default constructor
+		*
+		* @param device Pointer to the Vulkan device
+		* @param transferQueue Queue of the transfer family (may be the same queue as graphicsQueue)
+		* @param graphicsQueue Queue of the graphics family the uploaded buffers are used on
+		* @param slotCount (Optional) Number of slots (see begin), e.g. the number of frames in flight
+		*/
+		UploadQueue(vks::VulkanDevice *device, VkQueue transferQueue, VkQueue graphicsQueue, uint32_t slotCount = 2)
+		{
+			assert(slotCount > 0);
+			this->device = device;
+			this->transferQueue = transferQueue;
+			this->graphicsQueue = graphicsQueue;
+
+			transferPool = device->createCommandPool(device->queueFamilyIndices.transfer);
+			if (ownershipTransfer())
+			{
+				graphicsPool = device->createCommandPool(device->queueFamilyIndices.graphics);
+			}
+
+			VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
+			VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+			slots.resize(slotCount);
+			for (auto& slot : slots)
+			{
+				VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(transferPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+				VK_CHECK_RESULT(vkAllocateCommandBuffers(device->logicalDevice, &cmdBufAllocateInfo, &slot.copyCmd));
+				VK_CHECK_RESULT(vkCreateSemaphore(device->logicalDevice, &semaphoreCreateInfo, nullptr, &slot.transferComplete));
+				if (ownershipTransfer())
+				{
+					cmdBufAllocateInfo.commandPool = graphicsPool;
+					VK_CHECK_RESULT(vkAllocateCommandBuffers(device->logicalDevice, &cmdBufAllocateInfo, &slot.acquireCmd));
+					VK_CHECK_RESULT(vkCreateSemaphore(device->logicalDevice, &semaphoreCreateInfo, nullptr, &slot.acquireComplete));
+				}
+				VK_CHECK_RESULT(vkCreateFence(device->logicalDevice, &fenceCreateInfo, nullptr, &slot.fence));
+			}
+
+			timestamps = new vks::TimestampQueries(device, device->queueFamilyIndices.transfer, slotCount, 2);
+		}
+
+		/** @brief Waits for pending uploads and frees all Vulkan resources */
+		~UploadQueue()
+		{
+			wait();
+			for (auto& slot : slots)
+			{
+				vkDestroySemaphore(device->logicalDevice, slot.transferComplete, nullptr);
+				if (slot.acquireComplete)
+				{
+					vkDestroySemaphore(device->logicalDevice, slot.acquireComplete, nullptr);
+				}
+				vkDestroyFence(device->logicalDevice, slot.fence, nullptr);
+			}
+			delete timestamps;
+			vkDestroyCommandPool(device->logicalDevice, transferPool, nullptr);
+			if (graphicsPool)
+			{
+				vkDestroyCommandPool(device->logicalDevice, graphicsPool, nullptr);
+			}
+		}
+
+		/** @brief Wait until all submitted uploads have finished (e.g. before freeing their buffers) */
+		void wait()
+		{
+			const vks::DeviceDispatch &vk = device->dispatch;
+			for (auto& slot : slots)
+			{
+				if (slot.submitted)
+				{
+					VK_CHECK_RESULT(vk.WaitForFences(device->logicalDevice, 1, &slot.fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
+				}
+			}
+		}
+
+		/**
+		* Start recording a new upload into a slot
+		*
+		* @param index Index of the slot, the graphics submission that waited on the last upload of this slot must have finished
+		* (e.g. the slot of a frame in flight, begun once the frame's fence has been waited on), so its semaphores can be signaled again
+		*
+		* @note Only waits for the last upload of the slot, so the source data of that upload can be rewritten after this call
+		*/
+		void begin(uint32_t index)
+		{
+			const vks::DeviceDispatch &vk = device->dispatch;
+			assert(!recording && index < slots.size());
+			current = index;
+			Slot &slot = slots[current];
+			if (slot.submitted)
+			{
+				VK_CHECK_RESULT(vk.WaitForFences(device->logicalDevice, 1, &slot.fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
+			}
+			collectTimings(current);
+
+			VK_CHECK_RESULT(vk.ResetFences(device->logicalDevice, 1, &slot.fence));
+			slot.submitted = false;
+
+			VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+			cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			VK_CHECK_RESULT(vk.BeginCommandBuffer(slot.copyCmd, &cmdBufInfo));
+			timestamps->reset(slot.copyCmd, current);
+			timestamps->write(slot.copyCmd, current, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+			ownershipBarriers.clear();
+			recording = true;
+		}
+
+		/**
+		* Record a copy into the current upload
+		*
+		* @param src Staging buffer to copy from
+		* @param dst Buffer to copy to, used on the graphics queue afterwards
+		* @param size Number of bytes to copy
+		* @param dstAccessMask Access of the graphics queue to dst after the upload (e.g. VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT)
+		* @param offset (Optional) Offset of the copied range, the same in src and dst (e.g. a staging buffer mirroring dst)
+		*
+		* @note The transfer queue only writes the copied range and never reads dst, so no ownership transfer back to the transfer queue is required
+		*/
+		void copy(vks::Buffer *src, vks::Buffer *dst, VkDeviceSize size, VkAccessFlags dstAccessMask, VkDeviceSize offset = 0)
+		{
+			VkBufferCopy copyRegion{};
+			copyRegion.srcOffset = offset;
+			copyRegion.dstOffset = offset;
+			copyRegion.size = size;
+			copy(src, dst, 1, &copyRegion, dstAccessMask);
+		}
+
+		/**
+		* Record a copy of several regions into the current upload (e.g. the changed parts of a buffer)
+		*
+		* @param regionCount Number of regions, empty regions are allowed
+		* @param regions Regions to copy from src to dst
+		*
+		* @note Each range of touching regions gets its own ownership barrier, so the gaps between them (which the graphics
+		* queue may still be reading) are never transferred
+		*/
+		void copy(vks::Buffer *src, vks::Buffer *dst, uint32_t regionCount, const VkBufferCopy *regions, VkAccessFlags dstAccessMask)
+		{
+			const vks::DeviceDispatch &vk = device->dispatch;
+			assert(recording);
+			copyRegions.clear();
+			for (uint32_t i = 0; i < regionCount; i++)
+			{
+				if (regions[i].size > 0)
+				{
+					copyRegions.push_back(regions[i]);
+				}
+			}
+			if (copyRegions.empty())
+			{
+				return;
+			}
+			vk.CmdCopyBuffer(slots[current].copyCmd, src->buffer, dst->buffer, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+
+			std::sort(copyRegions.begin(), copyRegions.end(), [](const VkBufferCopy &a, const VkBufferCopy &b) { return a.dstOffset < b.dstOffset; });
+			VkBufferMemoryBarrier barrier = vks::initializers::bufferMemoryBarrier();
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = dstAccessMask;
+			barrier.srcQueueFamilyIndex = device->queueFamilyIndices.transfer;
+			barrier.dstQueueFamilyIndex = device->queueFamilyIndices.graphics;
+			barrier.buffer = dst->buffer;
+			barrier.offset = copyRegions[0].dstOffset;
+			VkDeviceSize end = copyRegions[0].dstOffset + copyRegions[0].size;
+			for (size_t i = 1; i < copyRegions.size(); i++)
+			{
+				if (copyRegions[i].dstOffset > end)
+				{
+					barrier.size = end - barrier.offset;
+					ownershipBarriers.push_back(barrier);
+					barrier.offset = copyRegions[i].dstOffset;
+				}
+				end = std::max(end, copyRegions[i].dstOffset + copyRegions[i].size);
+			}
+			barrier.size = end - barrier.offset;
+			ownershipBarriers.push_back(barrier);
+		}
+
+		/**
+		* Submit the current upload to the transfer queue, doesn't wait for it to finish
+		*
+		* @note If the semaphore of a previous upload hasn't been taken yet, this upload waits on it instead
+		*/
+		void submit()
+		{
+			const vks::DeviceDispatch &vk = device->dispatch;
+			assert(recording);
+			recording = false;
+			Slot &slot = slots[current];
+
+			timestamps->write(slot.copyCmd, current, 1, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+			if (ownershipTransfer() && !ownershipBarriers.empty())
+			{
+				// Release the buffers from the transfer queue family
+				std::vector<VkBufferMemoryBarrier> releaseBarriers = ownershipBarriers;
+				for (auto& barrier : releaseBarriers)
+				{
+					barrier.dstAccessMask = 0;
+				}
+				vk.CmdPipelineBarrier(slot.copyCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, static_cast<uint32_t>(releaseBarriers.size()), releaseBarriers.data(), 0, nullptr);
+			}
+			VK_CHECK_RESULT(vk.EndCommandBuffer(slot.copyCmd));
+
+			VkPipelineStageFlags transferWaitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+			VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+			if (pendingSemaphore)
+			{
+				// Chain the previous upload that no graphics submission has waited on
+				submitInfo.waitSemaphoreCount = 1;
+				submitInfo.pWaitSemaphores = &pendingSemaphore;
+				submitInfo.pWaitDstStageMask = &transferWaitStage;
+			}
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &slot.copyCmd;
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &slot.transferComplete;
+
+			if (!ownershipTransfer())
+			{
+				VK_CHECK_RESULT(vk.QueueSubmit(transferQueue, 1, &submitInfo, slot.fence));
+				pendingSemaphore = slot.transferComplete;
+				slot.submitted = true;
+				return;
+			}
+
+			VK_CHECK_RESULT(vk.QueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
+
+			// Acquire the buffers on the graphics queue family once the transfer has finished
+			VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+			cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			VK_CHECK_RESULT(vk.BeginCommandBuffer(slot.acquireCmd, &cmdBufInfo));
+			std::vector<VkBufferMemoryBarrier> acquireBarriers = ownershipBarriers;
+			for (auto& barrier : acquireBarriers)
+			{
+				barrier.srcAccessMask = 0;
+			}
+			if (!acquireBarriers.empty())
+			{
+				vk.CmdPipelineBarrier(slot.acquireCmd, waitStage, waitStage, 0, 0, nullptr, static_cast<uint32_t>(acquireBarriers.size()), acquireBarriers.data(), 0, nullptr);
+			}
+			VK_CHECK_RESULT(vk.EndCommandBuffer(slot.acquireCmd));
+
+			VkSubmitInfo acquireSubmitInfo = vks::initializers::submitInfo();
+			acquireSubmitInfo.waitSemaphoreCount = 1;
+			acquireSubmitInfo.pWaitSemaphores = &slot.transferComplete;
+			acquireSubmitInfo.pWaitDstStageMask = &waitStage;
+			acquireSubmitInfo.commandBufferCount = 1;
+			acquireSubmitInfo.pCommandBuffers = &slot.acquireCmd;
+			acquireSubmitInfo.signalSemaphoreCount = 1;
+			acquireSubmitInfo.pSignalSemaphores = &slot.acquireComplete;
+			VK_CHECK_RESULT(vk.QueueSubmit(graphicsQueue, 1, &acquireSubmitInfo, slot.fence));
+
+			pendingSemaphore = slot.acquireComplete;
+			slot.submitted = true;
+		}
+
+		/**
+		* Get the semaphore of the last upload, to be waited on (at waitStage) by the next graphics submission
+		*
+		* @return Semaphore handle or VK_NULL_HANDLE if there is no upload to wait for
+		*
+		* @note The semaphore has to be waited on if a handle is returned, it can only be taken once
+		*/
+		VkSemaphore takeWaitSemaphore()
+		{
+			VkSemaphore semaphore = pendingSemaphore;
+			pendingSemaphore = VK_NULL_HANDLE;
+			return semaphore;
+		}
+	};
+}
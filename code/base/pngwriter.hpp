@@ -0,0 +1,140 @@
+/*
+* Minimal PNG writer
+*
+* Writes 8 bit RGBA images uncompressed (stored deflate blocks), e.g. for frame dumps of the headless mode
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+
+namespace vks
+{
+	namespace png
+	{
+		/** @brief CRC-32 as used by the PNG chunks */
+		inline uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0)
+		{
+			static uint32_t table[256];
+			static bool tableReady = false;
+			if (!tableReady)
+			{
+				for (uint32_t n = 0; n < 256; n++)
+				{
+					uint32_t c = n;
+					for (int k = 0; k < 8; k++)
+					{
+						c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+					}
+					table[n] = c;
+				}
+				tableReady = true;
+			}
+			crc = ~crc;
+			for (size_t i = 0; i < size; i++)
+			{
+				crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+			}
+			return ~crc;
+		}
+
+		inline void appendUint32(std::vector<uint8_t> &out, uint32_t value)
+		{
+			out.push_back(static_cast<uint8_t>(value >> 24));
+			out.push_back(static_cast<uint8_t>(value >> 16));
+			out.push_back(static_cast<uint8_t>(value >> 8));
+			out.push_back(static_cast<uint8_t>(value));
+		}
+
+		inline void appendChunk(std::vector<uint8_t> &out, const char *type, const std::vector<uint8_t> &data)
+		{
+			appendUint32(out, static_cast<uint32_t>(data.size()));
+			size_t start = out.size();
+			out.insert(out.end(), type, type + 4);
+			out.insert(out.end(), data.begin(), data.end());
+			// The CRC covers the chunk type and data
+			appendUint32(out, crc32(&out[start], out.size() - start));
+		}
+
+		/**
+		* Write an 8 bit RGBA image to a PNG file
+		*
+		* @param filename Path of the file to write
+		* @param width Width of the image in pixels
+		* @param height Height of the image in pixels
+		* @param pixels First row of the RGBA pixels
+		* @param rowPitch Distance between two rows in bytes (at least width * 4)
+		*
+		* @return False if the file could not be written
+		*/
+		inline bool write(const std::string &filename, uint32_t width, uint32_t height, const uint8_t *pixels, size_t rowPitch)
+		{
+			// Raw scanlines, each prefixed by filter type 0 (none)
+			const size_t rowSize = static_cast<size_t>(width) * 4;
+			std::vector<uint8_t> raw;
+			raw.reserve((rowSize + 1) * height);
+			for (uint32_t y = 0; y < height; y++)
+			{
+				raw.push_back(0);
+				const uint8_t *row = pixels + y * rowPitch;
+				raw.insert(raw.end(), row, row + rowSize);
+			}
+
+			// zlib stream of stored (uncompressed) deflate blocks, at most 65535 bytes each
+			std::vector<uint8_t> idat;
+			idat.push_back(0x78);
+			idat.push_back(0x01);
+			size_t offset = 0;
+			do
+			{
+				size_t blockSize = raw.size() - offset;
+				if (blockSize > 65535)
+				{
+					blockSize = 65535;
+				}
+				bool lastBlock = (offset + blockSize == raw.size());
+				idat.push_back(lastBlock ? 1 : 0);
+				idat.push_back(static_cast<uint8_t>(blockSize));
+				idat.push_back(static_cast<uint8_t>(blockSize >> 8));
+				idat.push_back(static_cast<uint8_t>(~blockSize));
+				idat.push_back(static_cast<uint8_t>(~blockSize >> 8));
+				idat.insert(idat.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+				offset += blockSize;
+			} while (offset < raw.size());
+
+			// Adler-32 of the uncompressed data
+			uint32_t a = 1, b = 0;
+			for (size_t i = 0; i < raw.size(); i++)
+			{
+				a = (a + raw[i]) % 65521;
+				b = (b + a) % 65521;
+			}
+			appendUint32(idat, (b << 16) | a);
+
+			std::vector<uint8_t> header;
+			appendUint32(header, width);
+			appendUint32(header, height);
+			// 8 bits per channel, RGBA, deflate, no filter method extensions, no interlacing
+			const uint8_t format[] = { 8, 6, 0, 0, 0 };
+			header.insert(header.end(), format, format + sizeof(format));
+
+			std::vector<uint8_t> file = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+			appendChunk(file, "IHDR", header);
+			appendChunk(file, "IDAT", idat);
+			appendChunk(file, "IEND", std::vector<uint8_t>());
+
+			std::ofstream stream(filename, std::ios::out | std::ios::binary);
+			if (!stream.is_open())
+			{
+				return false;
+			}
+			stream.write(reinterpret_cast<const char*>(file.data()), file.size());
+			return stream.good();
+		}
+	}
+}
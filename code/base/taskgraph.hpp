@@ -0,0 +1,236 @@
+/*
+* Dependency graph of one-shot tasks run on a thread pool, with a timeline of where the time went
+*
+* Used to overlap independent startup work (asset import, shader modules, pipeline compilation)
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <assert.h>
+
+#include "VulkanTools.h"
+#include "threadpool.hpp"
+
+namespace vks
+{
+	/**
+	* @brief Named time spans relative to a common origin, e.g. the stages of the startup
+	*
+	* Spans can be added from any thread, the thread index is only used for the report (0 = main thread)
+	*/
+	class Timeline
+	{
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		struct Span
+		{
+			std::string name;
+			uint32_t thread;
+			double start;
+			double end;
+		};
+
+	private:
+		Clock::time_point origin;
+		std::vector<Span> spans;
+		std::mutex lock;
+
+	public:
+		Timeline()
+		{
+			origin = Clock::now();
+		}
+
+		/** @brief Milliseconds since the origin of the timeline */
+		double now() const
+		{
+			return std::chrono::duration<double, std::milli>(Clock::now() - origin).count();
+		}
+
+		/** @brief Add a span, start and end in milliseconds since the origin (see now) */
+		void add(const std::string &name, uint32_t thread, double start, double end)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			Span span = { name, thread, start, end };
+			spans.push_back(span);
+		}
+
+		/** @brief Log all spans ordered by their start, one line each */
+		void log(const std::string &title)
+		{
+			std::vector<Span> sorted;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				sorted = spans;
+			}
+			std::stable_sort(sorted.begin(), sorted.end(), [](const Span &a, const Span &b) { return a.start < b.start; });
+			double end = 0.0;
+			for (auto &span : sorted)
+			{
+				end = std::max(end, span.end);
+			}
+			LOGI("%s (%.1f ms)", title.c_str(), end);
+			for (auto &span : sorted)
+			{
+				if (span.thread == 0)
+				{
+					LOGI("  %8.1f - %8.1f ms %8.1f ms  main      %s", span.start, span.end, span.end - span.start, span.name.c_str());
+				}
+				else
+				{
+					LOGI("  %8.1f - %8.1f ms %8.1f ms  worker %-2u %s", span.start, span.end, span.end - span.start, span.thread, span.name.c_str());
+				}
+			}
+		}
+	};
+
+	/**
+	* @brief Runs a set of one-shot tasks in dependency order, independent tasks run concurrently
+	*
+	* Tasks can only depend on tasks added before them, so the graph can't contain cycles. Tasks that must run on the
+	* calling thread (e.g. because they submit to a queue the calling thread also uses) are marked with mainThread,
+	* all others are picked up by the workers of the pool.
+	*/
+	class TaskGraph
+	{
+	public:
+		typedef uint32_t Task;
+
+	private:
+		struct Node
+		{
+			std::string name;
+			std::function<void()> function;
+			bool mainThread;
+			uint32_t pendingDependencies;
+			std::vector<Task> dependents;
+		};
+
+		std::vector<Node> nodes;
+		std::vector<Task> readyMain;
+		std::vector<Task> readyWorker;
+		uint32_t finished = 0;
+		std::mutex lock;
+		std::condition_variable condition;
+		Timeline *timeline = nullptr;
+
+		void execute(Task task, uint32_t thread)
+		{
+			double start = timeline ? timeline->now() : 0.0;
+			nodes[task].function();
+			if (timeline)
+			{
+				timeline->add(nodes[task].name, thread, start, timeline->now());
+			}
+
+			std::lock_guard<std::mutex> guard(lock);
+			finished++;
+			for (auto dependent : nodes[task].dependents)
+			{
+				if (--nodes[dependent].pendingDependencies == 0)
+				{
+					(nodes[dependent].mainThread ? readyMain : readyWorker).push_back(dependent);
+				}
+			}
+			condition.notify_all();
+		}
+
+		/** @brief Run ready tasks until all tasks have finished, the main thread also helps out with worker tasks if there are no workers */
+		void process(uint32_t thread, bool runWorkerTasks)
+		{
+			bool mainThread = (thread == 0);
+			while (true)
+			{
+				Task task;
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					condition.wait(guard, [&] {
+						return (finished == nodes.size()) || (mainThread && !readyMain.empty()) || (runWorkerTasks && !readyWorker.empty());
+					});
+					if (mainThread && !readyMain.empty())
+					{
+						task = readyMain.front();
+						readyMain.erase(readyMain.begin());
+					}
+					else if (runWorkerTasks && !readyWorker.empty())
+					{
+						task = readyWorker.front();
+						readyWorker.erase(readyWorker.begin());
+					}
+					else
+					{
+						// All tasks have finished
+						return;
+					}
+				}
+				execute(task, thread);
+			}
+		}
+
+	public:
+		/**
+		* Add a task to the graph
+		*
+		* @param name Name of the task in the timeline
+		* @param function Work of the task
+		* @param dependencies Tasks that have to finish before this one starts
+		* @param mainThread Run the task on the thread calling run
+		*
+		* @return Handle of the task to be used as a dependency of later tasks
+		*/
+		Task add(const std::string &name, std::function<void()> function, std::vector<Task> dependencies = std::vector<Task>(), bool mainThread = false)
+		{
+			Task task = static_cast<Task>(nodes.size());
+			Node node;
+			node.name = name;
+			node.function = function;
+			node.mainThread = mainThread;
+			node.pendingDependencies = static_cast<uint32_t>(dependencies.size());
+			nodes.push_back(node);
+			for (auto dependency : dependencies)
+			{
+				assert(dependency < task);
+				nodes[dependency].dependents.push_back(task);
+			}
+			return task;
+		}
+
+		/**
+		* Run all tasks and wait for them to finish
+		*
+		* @param pool Pool whose threads run the worker tasks (must not have other work queued)
+		* @param timeline (Optional) Timeline the task spans are added to
+		*/
+		void run(vks::ThreadPool &pool, Timeline *timeline = nullptr)
+		{
+			this->timeline = timeline;
+			finished = 0;
+			readyMain.clear();
+			readyWorker.clear();
+			for (Task task = 0; task < nodes.size(); task++)
+			{
+				if (nodes[task].pendingDependencies == 0)
+				{
+					(nodes[task].mainThread ? readyMain : readyWorker).push_back(task);
+				}
+			}
+
+			for (uint32_t t = 0; t < pool.threads.size(); t++)
+			{
+				pool.threads[t]->addJob([=] { process(t + 1, true); });
+			}
+			process(0, pool.threads.empty());
+			pool.wait();
+		}
+	};
+}
@@ -6,7 +6,10 @@
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
 */
 
+#pragma once
+
 #include <vector>
+#include <memory>
 #include <thread>
 #include <queue>
 #include <mutex>
@@ -104,7 +107,7 @@ namespace vks
 			threads.clear();
 			for (auto i = 0; i < count; i++)
 			{
-				threads.push_back(make_unique<Thread>());
+				threads.push_back(::make_unique<Thread>());
 			}
 		}
 
@@ -20,13 +20,18 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 	appInfo.pEngineName = name.c_str();
 	appInfo.apiVersion = VK_API_VERSION_1_0;
 
-	std::vector<const char*> instanceExtensions = { VK_KHR_SURFACE_EXTENSION_NAME };
+	std::vector<const char*> instanceExtensions;
+#if !defined(_HEADLESS)
+	instanceExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+#endif
 
 	// Enable surface extensions depending on os
 #if defined(_WIN32)
 	instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
 #elif defined(__ANDROID__)
 	instanceExtensions.push_back(VK_KHR_ANDROID_SURFACE_EXTENSION_NAME);
+#elif defined(_HEADLESS)
+	// Nothing is presented, no surface extensions required
 #elif defined(_DIRECT2DISPLAY)
 	instanceExtensions.push_back(VK_KHR_DISPLAY_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
@@ -39,12 +44,12 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 	instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	instanceCreateInfo.pNext = NULL;
 	instanceCreateInfo.pApplicationInfo = &appInfo;
+	if (settings.validation)
+	{
+		instanceExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+	}
 	if (instanceExtensions.size() > 0)
 	{
-		if (settings.validation)
-		{
-			instanceExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
-		}
 		instanceCreateInfo.enabledExtensionCount = (uint32_t)instanceExtensions.size();
 		instanceCreateInfo.ppEnabledExtensionNames = instanceExtensions.data();
 	}
@@ -72,6 +77,8 @@ const std::string VulkanExampleBase::getAssetPath()
 {
 #if defined(__ANDROID__)
 	return "";
+#elif defined(_HEADLESS)
+	return ASSET_PATH;
 #else
 	return "./../data/";
 #endif
@@ -108,6 +115,34 @@ void VulkanExampleBase::destroyCommandBuffers()
 	vkFreeCommandBuffers(device, cmdPool, static_cast<uint32_t>(drawCmdBuffers.size()), drawCmdBuffers.data());
 }
 
+void VulkanExampleBase::createSynchronizationPrimitives()
+{
+	// Fences are created signaled, so the first wait for each frame doesn't block
+	VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+	waitFences.resize(drawCmdBuffers.size());
+	for (auto& fence : waitFences)
+	{
+		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence));
+	}
+}
+
+void VulkanExampleBase::destroySynchronizationPrimitives()
+{
+	for (auto& fence : waitFences)
+	{
+		vkDestroyFence(device, fence, nullptr);
+	}
+	waitFences.clear();
+}
+
+void VulkanExampleBase::waitForFrames()
+{
+	if (!waitFences.empty())
+	{
+		VK_CHECK_RESULT(vulkanDevice->dispatch.WaitForFences(device, static_cast<uint32_t>(waitFences.size()), waitFences.data(), VK_TRUE, UINT64_MAX));
+	}
+}
+
 VkCommandBuffer VulkanExampleBase::createCommandBuffer(VkCommandBufferLevel level, bool begin)
 {
 	VkCommandBuffer cmdBuffer;
@@ -144,8 +179,8 @@ void VulkanExampleBase::flushCommandBuffer(VkCommandBuffer commandBuffer, VkQueu
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &commandBuffer;
 
-	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
-	VK_CHECK_RESULT(vkQueueWaitIdle(queue));
+	VK_CHECK_RESULT(vulkanDevice->dispatch.QueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+	VK_CHECK_RESULT(vulkanDevice->dispatch.QueueWaitIdle(queue));
 
 	if (free)
 	{
@@ -169,6 +204,7 @@ void VulkanExampleBase::prepare()
 	createCommandPool();
 	setupSwapChain();
 	createCommandBuffers();
+	createSynchronizationPrimitives();
 	setupDepthStencil();
 	setupRenderPass();
 	createPipelineCache();
@@ -188,12 +224,22 @@ void VulkanExampleBase::prepare()
 			depthFormat,
 			&width,
 			&height,
-			shaderStages
+			shaderStages,
+			textOverlayMode
 			);
 		updateTextOverlay();
 	}
 }
 
+bool VulkanExampleBase::assetExists(std::string fileName)
+{
+#if defined(__ANDROID__)
+	return vks::tools::fileExists(androidApp->activity->assetManager, fileName.c_str());
+#else
+	return vks::tools::fileExists(fileName.c_str());
+#endif
+}
+
 VkPipelineShaderStageCreateInfo VulkanExampleBase::loadShader(std::string fileName, VkShaderStageFlagBits stage)
 {
 	VkPipelineShaderStageCreateInfo shaderStage = {};
@@ -206,12 +252,17 @@ VkPipelineShaderStageCreateInfo VulkanExampleBase::loadShader(std::string fileNa
 #endif
 	shaderStage.pName = "main"; // todo : make param
 	assert(shaderStage.module != VK_NULL_HANDLE);
+	std::lock_guard<std::mutex> guard(shaderModulesLock);
 	shaderModules.push_back(shaderStage.module);
 	return shaderStage;
 }
 
 void VulkanExampleBase::stopRenderLoop() {
+#if defined(_HEADLESS)
+	quit = true;
+#else
 	rendering = false;
+#endif
 }
 
 void VulkanExampleBase::renderLoop()
@@ -274,6 +325,7 @@ void VulkanExampleBase::renderLoop()
 		}
 	}
 #elif defined(__ANDROID__)
+	lastLoopTime = std::chrono::steady_clock::now();
 	while (1)
 	{
 		int ident;
@@ -283,11 +335,17 @@ void VulkanExampleBase::renderLoop()
 
 		focused = true;
 
-		while ((ident = ALooper_pollAll(focused ? 0 : -1, NULL, &events, (void**)&source)) >= 0)
+		// Block for a short time if the last frame was skipped, so an idle scene doesn't spin the loop
+		int pollTimeout = focused ? (frameSkipped ? idlePollTimeout : 0) : -1;
+
+		while ((ident = ALooper_pollAll(pollTimeout, NULL, &events, (void**)&source)) >= 0)
 		{
+			pollTimeout = 0;
 			if (source != NULL)
 			{
 				source->process(androidApp, source);
+				// Input and app commands may change what is displayed
+				requestFrame();
 			}
 			if (androidApp->destroyRequested != 0)
 			{
@@ -307,11 +365,22 @@ void VulkanExampleBase::renderLoop()
 		// Render frame
 		if (prepared)
 		{
-			auto tStart = std::chrono::high_resolution_clock::now();
+			// Don't start frames faster than the pacing mode allows (the wait counts towards the frame time)
+			framePacer.waitForNextFrame();
 			render();
-			frameCounter++;
-			auto tEnd = std::chrono::high_resolution_clock::now();
-			auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+			if (frameSkipped)
+			{
+				// Idle time doesn't count as a (missed) frame
+				framePacer.reset();
+			}
+			else
+			{
+				frameCounter++;
+			}
+			// Wall clock time since the previous pass, including the idle poll above
+			auto tNow = std::chrono::steady_clock::now();
+			auto tDiff = std::chrono::duration<double, std::milli>(tNow - lastLoopTime).count();
+			lastLoopTime = tNow;
 			frameTimer = tDiff / 1000.0f;
 			camera.update(frameTimer);
 			// Convert to clamped timer value
@@ -327,6 +396,11 @@ void VulkanExampleBase::renderLoop()
 			if (fpsTimer > 1000.0f)
 			{
 				lastFPS = frameCounter;
+				LOGD("Frame pacing: %s", framePacer.getSummary().c_str());
+				if (callAccounting.enabled())
+				{
+					LOGD("%s", callAccounting.getSummary().c_str());
+				}
 				updateTextOverlay();
 				fpsTimer = 0.0f;
 				frameCounter = 0;
@@ -382,7 +456,74 @@ void VulkanExampleBase::renderLoop()
 				}
 			}
 		}
+		else
+		{
+			// The time until the example is (re)prepared doesn't advance the timers
+			lastLoopTime = std::chrono::steady_clock::now();
+		}
+	}
+#elif defined(_HEADLESS)
+	// Render a fixed number of frames as fast as the pacing mode allows and report the timings
+	auto tBenchmarkStart = std::chrono::high_resolution_clock::now();
+	uint32_t renderedFrames = 0;
+	lastLoopTime = std::chrono::steady_clock::now();
+	while (!quit && (renderedFrames < headless.frameCount))
+	{
+		if (viewUpdated)
+		{
+			viewUpdated = false;
+			viewChanged();
+		}
+		framePacer.waitForNextFrame();
+		render();
+		if (frameSkipped)
+		{
+			framePacer.reset();
+		}
+		else
+		{
+			frameCounter++;
+			renderedFrames++;
+		}
+		// Wall clock time since the previous pass, skipped frames included
+		auto tNow = std::chrono::steady_clock::now();
+		auto tDiff = std::chrono::duration<double, std::milli>(tNow - lastLoopTime).count();
+		lastLoopTime = tNow;
+		frameTimer = tDiff / 1000.0f;
+		camera.update(frameTimer);
+		if (camera.moving())
+		{
+			viewUpdated = true;
+		}
+		// Convert to clamped timer value
+		if (!paused)
+		{
+			timer += timerSpeed * frameTimer;
+			if (timer > 1.0)
+			{
+				timer -= 1.0f;
+			}
+		}
+		fpsTimer += (float)tDiff;
+		if (fpsTimer > 1000.0f)
+		{
+			lastFPS = frameCounter;
+			LOGI("%u fps, frame pacing: %s", lastFPS, framePacer.getSummary().c_str());
+			if (callAccounting.enabled())
+			{
+				LOGI("%s", callAccounting.getSummary().c_str());
+			}
+			updateTextOverlay();
+			fpsTimer = 0.0f;
+			frameCounter = 0;
+		}
 	}
+	vkDeviceWaitIdle(device);
+	auto tBenchmarkEnd = std::chrono::high_resolution_clock::now();
+	double benchmarkTime = std::chrono::duration<double, std::milli>(tBenchmarkEnd - tBenchmarkStart).count();
+	LOGI("Rendered %u frames (%ux%u, %u images) in %.2f ms, %.3f ms per frame",
+		renderedFrames, width, height, headless.imageCount, benchmarkTime, (renderedFrames > 0) ? benchmarkTime / renderedFrames : 0.0);
+	LOGI("Frame pacing: %s", framePacer.getSummary().c_str());
 #elif defined(_DIRECT2DISPLAY)
 	while (!quit)
 	{
@@ -544,9 +685,48 @@ void VulkanExampleBase::updateTextOverlay()
 #endif
 	textOverlay->addText(deviceName, 5.0f, 45.0f, VulkanTextOverlay::alignLeft);
 
+	textOverlay->addText(framePacer.getSummary(), 5.0f, 65.0f, VulkanTextOverlay::alignLeft);
+
+	if (callAccounting.enabled())
+	{
+		textOverlay->addText(callAccounting.getSummary(), 5.0f, height - 20.0f, VulkanTextOverlay::alignLeft);
+	}
+
 	getOverlayText(textOverlay);
 
-	textOverlay->endTextUpdate();
+	// The new text reaches each frame buffer's slice of the overlay once its frame has finished (see prepareFrame)
+	if (textOverlay->endTextUpdate())
+	{
+		requestFrame();
+	}
+}
+
+void VulkanExampleBase::requestFrame()
+{
+	frameRequested = true;
+}
+
+bool VulkanExampleBase::frameRequired()
+{
+	auto now = std::chrono::high_resolution_clock::now();
+	bool keepAlive = std::chrono::duration<double, std::milli>(now - lastFrameTime).count() >= keepAliveInterval;
+	if (!settings.renderOnDemand || frameRequested || keepAlive)
+	{
+		frameRequested = false;
+		frameSkipped = false;
+		lastFrameTime = now;
+		return true;
+	}
+	frameSkipped = true;
+	return false;
+}
+
+void VulkanExampleBase::drawTextOverlay(VkCommandBuffer commandBuffer, uint32_t frame)
+{
+	if (enableTextOverlay && (textOverlay->renderMode == VulkanTextOverlay::renderModeInline))
+	{
+		textOverlay->draw(commandBuffer, frame);
+	}
 }
 
 void VulkanExampleBase::getOverlayText(VulkanTextOverlay *textOverlay)
@@ -558,17 +738,36 @@ bool VulkanExampleBase::prepareFrame()
 {
 	// Acquire the next image from the swap chaing
 //	VK_CHECK_RESULT(swapChain.acquireNextImage(semaphores.presentComplete, &currentBuffer));
+	callAccounting.beginFrame(vulkanDevice->dispatch);
+	if (firstFrameStart == 0.0)
+	{
+		firstFrameStart = startupTimeline.now();
+	}
+	framePacer.beginAcquire();
+#if defined(_HEADLESS)
+	// Nothing to acquire, the offscreen images are used in rotation
+	currentBuffer = (currentBuffer + 1) % swapChain.imageCount;
+#else
 	VkResult result = swapChain.acquireNextImage(semaphores.presentComplete, &currentBuffer);
 	if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR){
 		return false;
-	}else{
-		return true;
 	}
+#endif
+	// Wait until the last frame rendered to this image has finished, the fence is signaled again by submitFrame
+	VK_CHECK_RESULT(vulkanDevice->dispatch.WaitForFences(device, 1, &waitFences[currentBuffer], VK_TRUE, UINT64_MAX));
+	VK_CHECK_RESULT(vulkanDevice->dispatch.ResetFences(device, 1, &waitFences[currentBuffer]));
+	if (enableTextOverlay)
+	{
+		textOverlay->updateFrame(currentBuffer);
+	}
+	framePacer.endAcquire();
+	return true;
 }
 
 void VulkanExampleBase::submitFrame()
 {
-	bool submitTextOverlay = enableTextOverlay && textOverlay->visible;
+	// Inline overlays are part of the frame's command buffer, only the legacy mode needs a second submit
+	bool submitTextOverlay = enableTextOverlay && textOverlay->visible && (textOverlay->renderMode == VulkanTextOverlay::renderModeSeparatePass);
 
 	if (submitTextOverlay)
 	{
@@ -587,7 +786,7 @@ void VulkanExampleBase::submitFrame()
 		// Submit current text overlay command buffer
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &textOverlay->cmdBuffers[currentBuffer];
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+		VK_CHECK_RESULT(vulkanDevice->dispatch.QueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
 
 		// Reset stage mask
 		submitInfo.pWaitDstStageMask = &submitPipelineStages;
@@ -600,9 +799,30 @@ void VulkanExampleBase::submitFrame()
 		submitInfo.pSignalSemaphores = &semaphores.renderComplete;
 	}
 
+	// Signal the frame's fence after all previous submissions (scene and text overlay) have finished
+	VK_CHECK_RESULT(vulkanDevice->dispatch.QueueSubmit(queue, 0, nullptr, waitFences[currentBuffer]));
+
+#if defined(_HEADLESS)
+	if ((headless.dumpInterval > 0) && (headless.submittedFrames % headless.dumpInterval == 0))
+	{
+		std::stringstream filename;
+		filename << headless.dumpDirectory << "/frame_" << std::setw(6) << std::setfill('0') << headless.submittedFrames << ".png";
+		dumpOffscreenTarget(currentBuffer, filename.str());
+	}
+	headless.submittedFrames++;
+#else
 	VK_CHECK_RESULT(swapChain.queuePresent(queue, currentBuffer, submitTextOverlay ? semaphores.textOverlayComplete : semaphores.renderComplete));
+#endif
 
-	VK_CHECK_RESULT(vkQueueWaitIdle(queue));
+	framePacer.endPresent();
+	callAccounting.endFrame();
+
+	if (firstFrameStart >= 0.0)
+	{
+		startupTimeline.add("first frame", 0, firstFrameStart, startupTimeline.now());
+		startupTimeline.log("Startup to first frame");
+		firstFrameStart = -1.0;
+	}
 }
 
 VulkanExampleBase::VulkanExampleBase(bool enableValidation)
@@ -624,6 +844,12 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 
 	settings.validation = enableValidation;
 
+#if defined(_HEADLESS)
+	// Benchmarks render every frame as fast as possible (can still be changed on the command line)
+	settings.renderOnDemand = false;
+	framePacer.mode = vks::FRAME_PACING_THROUGHPUT;
+#endif
+
 	// Parse command line arguments
 	for (size_t i = 0; i < args.size(); i++)
 	{
@@ -635,6 +861,27 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 		{
 			settings.vsync = true;
 		}
+		if (args[i] == std::string("-continuous"))
+		{
+			settings.renderOnDemand = false;
+		}
+		if (args[i] == std::string("-callstats"))
+		{
+			callAccounting.setEnabled(true);
+		}
+		if ((args[i] == std::string("-pacing")) && (i + 1 < args.size()))
+		{
+			std::string pacing(args[i + 1]);
+			if (pacing == "latency") { framePacer.mode = vks::FRAME_PACING_LATENCY; };
+			if (pacing == "throughput") { framePacer.mode = vks::FRAME_PACING_THROUGHPUT; };
+			if (pacing == "fixed") { framePacer.mode = vks::FRAME_PACING_FIXED_RATE; };
+		}
+		if ((args[i] == std::string("-targetfps")) && (i + 1 < args.size()))
+		{
+			char* endptr;
+			uint32_t fps = strtol(args[i + 1], &endptr, 10);
+			if ((endptr != args[i + 1]) && (fps > 0)) { framePacer.targetFrameTime = 1000.0 / fps; };
+		}
 		if (args[i] == std::string("-fullscreen"))
 		{
 			settings.fullscreen = true;
@@ -651,12 +898,38 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 			uint32_t h = strtol(args[i + 1], &endptr, 10);
 			if (endptr != args[i + 1]) { height = h; };
 		}
+#if defined(_HEADLESS)
+		if ((args[i] == std::string("-frames")) && (i + 1 < args.size()))
+		{
+			char* endptr;
+			uint32_t frames = strtol(args[i + 1], &endptr, 10);
+			if (endptr != args[i + 1]) { headless.frameCount = frames; };
+		}
+		if ((args[i] == std::string("-images")) && (i + 1 < args.size()))
+		{
+			char* endptr;
+			uint32_t images = strtol(args[i + 1], &endptr, 10);
+			if ((endptr != args[i + 1]) && (images > 0)) { headless.imageCount = images; };
+		}
+		if ((args[i] == std::string("-dump")) && (i + 1 < args.size()))
+		{
+			char* endptr;
+			uint32_t interval = strtol(args[i + 1], &endptr, 10);
+			if (endptr != args[i + 1]) { headless.dumpInterval = interval; };
+		}
+		if ((args[i] == std::string("-dumpdir")) && (i + 1 < args.size()))
+		{
+			headless.dumpDirectory = args[i + 1];
+		}
+#endif
 	}
 	
 #if defined(__ANDROID__)
 	// Vulkan library is loaded dynamically on Android
 	bool libLoaded = vks::android::loadVulkanLibrary();
 	assert(libLoaded);
+#elif defined(_HEADLESS)
+
 #elif defined(_DIRECT2DISPLAY)
 
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
@@ -678,7 +951,9 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 VulkanExampleBase::~VulkanExampleBase()
 {
 	// Clean up Vulkan resources
+#if !defined(_HEADLESS)
 	swapChain.cleanup();
+#endif
 	if (descriptorPool != VK_NULL_HANDLE)
 	{
 		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
@@ -689,6 +964,9 @@ VulkanExampleBase::~VulkanExampleBase()
 	{
 		vkDestroyFramebuffer(device, frameBuffers[i], nullptr);
 	}
+#if defined(_HEADLESS)
+	destroyOffscreenTargets();
+#endif
 
 	for (auto& shaderModule : shaderModules)
 	{
@@ -705,6 +983,7 @@ VulkanExampleBase::~VulkanExampleBase()
 	vkDestroySemaphore(device, semaphores.presentComplete, nullptr);
 	vkDestroySemaphore(device, semaphores.renderComplete, nullptr);
 	vkDestroySemaphore(device, semaphores.textOverlayComplete, nullptr);
+	destroySynchronizationPrimitives();
 
 	if (enableTextOverlay)
 	{
@@ -720,7 +999,9 @@ VulkanExampleBase::~VulkanExampleBase()
 
 	vkDestroyInstance(instance, nullptr);
 
-#if defined(_DIRECT2DISPLAY)
+#if defined(_HEADLESS)
+
+#elif defined(_DIRECT2DISPLAY)
 
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
 	wl_shell_surface_destroy(shell_surface);
@@ -746,6 +1027,7 @@ VulkanExampleBase::~VulkanExampleBase()
 
 void VulkanExampleBase::initVulkan()
 {
+	double initStart = startupTimeline.now();
 	VkResult err;
 
 	// Vulkan instance
@@ -852,7 +1134,7 @@ void VulkanExampleBase::initVulkan()
 	// This is handled by a separate class that gets a logical device representation
 	// and encapsulates functions related to a device
 	vulkanDevice = new vks::VulkanDevice(physicalDevice);
-	VkResult res = vulkanDevice->createLogicalDevice(enabledFeatures, enabledExtensions, true, VK_QUEUE_GRAPHICS_BIT);
+	VkResult res = vulkanDevice->createLogicalDevice(enabledFeatures, enabledExtensions, true, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_TRANSFER_BIT);
 	if (res != VK_SUCCESS) {
 		vks::tools::exitFatal("Could not create Vulkan device: \n" + vks::tools::errorString(res), "Fatal error");
 	}
@@ -860,12 +1142,19 @@ void VulkanExampleBase::initVulkan()
 
 	// Get a graphics queue from the device
 	vkGetDeviceQueue(device, vulkanDevice->queueFamilyIndices.graphics, 0, &queue);
+	// Get a transfer queue, prefers a dedicated transfer family
+	vkGetDeviceQueue(device, vulkanDevice->queueFamilyIndices.transfer, 0, &transferQueue);
 
 	// Find a suitable depth format
 	VkBool32 validDepthFormat = vks::tools::getSupportedDepthFormat(physicalDevice, &depthFormat);
 	assert(validDepthFormat);
 
+#if defined(_HEADLESS)
+	// No surface, the offscreen images are rendered on the graphics queue
+	swapChain.queueNodeIndex = vulkanDevice->queueFamilyIndices.graphics;
+#else
 	swapChain.connect(instance, physicalDevice, device);
+#endif
 
 	// Create synchronization objects
 	VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
@@ -889,6 +1178,11 @@ void VulkanExampleBase::initVulkan()
 	submitInfo.pWaitSemaphores = &semaphores.presentComplete;
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = &semaphores.renderComplete;
+#if defined(_HEADLESS)
+	// Nothing is acquired or presented, frames are only ordered by the queue and their fences
+	submitInfo.waitSemaphoreCount = 0;
+	submitInfo.signalSemaphoreCount = 0;
+#endif
 
 #if defined(__ANDROID__)
 	// Get Android device name and manufacturer (to display along GPU name)
@@ -904,6 +1198,8 @@ void VulkanExampleBase::initVulkan()
 	};
 	LOGD("androidProduct = %s", androidProduct.c_str());
 #endif	
+
+	startupTimeline.add("initVulkan", 0, initStart, startupTimeline.now());
 }
 
 #if defined(_WIN32)
@@ -1055,6 +1351,7 @@ void VulkanExampleBase::handleMessages(HWND hWnd, UINT uMsg, WPARAM wParam, LPAR
 			if (enableTextOverlay)
 			{
 				textOverlay->visible = !textOverlay->visible;
+				updateTextOverlay();
 			}
 			break;
 		case KEY_ESCAPE:
@@ -1280,6 +1577,10 @@ int32_t VulkanExampleBase::handleAppInput(struct android_app* app, AInputEvent*
 		case AKEYCODE_BUTTON_START:
 			vulkanExample->paused = !vulkanExample->paused;
 			break;
+		case AKEYCODE_BUTTON_SELECT:
+			vulkanExample->callAccounting.setEnabled(!vulkanExample->callAccounting.enabled());
+			vulkanExample->requestFrame();
+			break;
 		};
 
 		LOGD("Button %d pressed", keyCode);
@@ -1331,6 +1632,82 @@ void VulkanExampleBase::handleAppCommand(android_app * app, int32_t cmd)
 		break;
 	}
 }
+#elif defined(_HEADLESS)
+void VulkanExampleBase::setupOffscreenTargets()
+{
+	destroyOffscreenTargets();
+	offscreenTargets.resize(swapChain.imageCount);
+	for (auto& target : offscreenTargets)
+	{
+		target = new vks::Framebuffer(vulkanDevice);
+		target->width = width;
+		target->height = height;
+		// Rendered to like a swap chain image, transfer source for the PNG dumps
+		vks::AttachmentCreateInfo attachmentInfo = {};
+		attachmentInfo.width = width;
+		attachmentInfo.height = height;
+		attachmentInfo.layerCount = 1;
+		attachmentInfo.format = swapChain.colorFormat;
+		attachmentInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		target->addAttachment(attachmentInfo);
+	}
+}
+
+void VulkanExampleBase::destroyOffscreenTargets()
+{
+	for (auto& target : offscreenTargets)
+	{
+		delete target;
+	}
+	offscreenTargets.clear();
+}
+
+void VulkanExampleBase::dumpOffscreenTarget(uint32_t imageIndex, const std::string &filename)
+{
+	vks::FramebufferAttachment &attachment = offscreenTargets[imageIndex]->attachments[0];
+
+	vks::Buffer readback;
+	VK_CHECK_RESULT(vulkanDevice->createBuffer(
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&readback,
+		static_cast<VkDeviceSize>(width) * height * 4));
+
+	VkCommandBuffer copyCmd = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+
+	// The render pass left the image in transfer source layout, make its color writes visible to the copy
+	VkImageMemoryBarrier imageBarrier = vks::initializers::imageMemoryBarrier();
+	imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	imageBarrier.image = attachment.image;
+	imageBarrier.subresourceRange = attachment.subresourceRange;
+	vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+	VkBufferImageCopy region = {};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = { width, height, 1 };
+	vkCmdCopyImageToBuffer(copyCmd, attachment.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.buffer, 1, &region);
+
+	VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+	bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	bufferBarrier.buffer = readback.buffer;
+	bufferBarrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+	// Waits for the queue, dumps are not meant to be part of the measured frames
+	flushCommandBuffer(copyCmd, queue, true);
+
+	VK_CHECK_RESULT(readback.map());
+	if (!vks::png::write(filename, width, height, static_cast<const uint8_t*>(readback.mapped), static_cast<size_t>(width) * 4))
+	{
+		LOGE("Could not write \"%s\"", filename.c_str());
+	}
+	readback.destroy();
+}
 #elif defined(_DIRECT2DISPLAY)
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
 /*static*/void VulkanExampleBase::registryGlobalCb(void *data,
@@ -1499,7 +1876,10 @@ void VulkanExampleBase::keyboardKey(struct wl_keyboard *keyboard,
 		break;
 	case KEY_F1:
 		if (state && enableTextOverlay)
+		{
 			textOverlay->visible = !textOverlay->visible;
+			updateTextOverlay();
+		}
 		break;
 	case KEY_ESC:
 		quit = true;
@@ -1815,6 +2195,7 @@ void VulkanExampleBase::handleEvent(const xcb_generic_event_t *event)
 				if (enableTextOverlay)
 				{
 					textOverlay->visible = !textOverlay->visible;
+					updateTextOverlay();
 				}
 				break;				
 		}
@@ -1903,7 +2284,8 @@ void VulkanExampleBase::setupDepthStencil()
 	image.arrayLayers = 1;
 	image.samples = VK_SAMPLE_COUNT_1_BIT;
 	image.tiling = VK_IMAGE_TILING_OPTIMAL;
-	image.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	// Depth is never read after the render pass, so it can stay in tile memory
+	image.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
 	image.flags = 0;
 
 	VkMemoryAllocateInfo mem_alloc = {};
@@ -1930,7 +2312,14 @@ void VulkanExampleBase::setupDepthStencil()
 	VK_CHECK_RESULT(vkCreateImage(device, &image, nullptr, &depthStencil.image));
 	vkGetImageMemoryRequirements(device, depthStencil.image, &memReqs);
 	mem_alloc.allocationSize = memReqs.size;
-	mem_alloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	// Prefer lazily allocated memory, fall back to device local memory if the device doesn't expose it
+	VkBool32 lazyMemoryFound = VK_FALSE;
+	mem_alloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, &lazyMemoryFound);
+	depthStencil.lazilyAllocated = (lazyMemoryFound == VK_TRUE);
+	if (!depthStencil.lazilyAllocated)
+	{
+		mem_alloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	}
 	VK_CHECK_RESULT(vkAllocateMemory(device, &mem_alloc, nullptr, &depthStencil.mem));
 	VK_CHECK_RESULT(vkBindImageMemory(device, depthStencil.image, depthStencil.mem, 0));
 
@@ -1959,7 +2348,11 @@ void VulkanExampleBase::setupFrameBuffer()
 	frameBuffers.resize(swapChain.imageCount);
 	for (uint32_t i = 0; i < frameBuffers.size(); i++)
 	{
+#if defined(_HEADLESS)
+		attachments[0] = offscreenTargets[i]->attachments[0].view;
+#else
 		attachments[0] = swapChain.buffers[i].view;
+#endif
 		VK_CHECK_RESULT(vkCreateFramebuffer(device, &frameBufferCreateInfo, nullptr, &frameBuffers[i]));
 	}
 }
@@ -1970,17 +2363,24 @@ void VulkanExampleBase::setupRenderPass()
 	// Color attachment
 	attachments[0].format = swapChain.colorFormat;
 	attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+	// Nothing is rendered underneath, clearing avoids loading the previous contents into tile memory
 	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+#if defined(_HEADLESS)
+	// Offscreen images are only ever copied out (see dumpOffscreenTarget)
+	attachments[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+#else
 	attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+#endif
 	// Depth attachment
+	// Only used within the render pass: cleared on load and never written back to memory
 	attachments[1].format = depthFormat;
 	attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
 	attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -2006,7 +2406,7 @@ void VulkanExampleBase::setupRenderPass()
 	subpassDescription.pResolveAttachments = nullptr;
 
 	// Subpass dependencies for layout transitions
-	std::array<VkSubpassDependency, 2> dependencies;
+	std::array<VkSubpassDependency, 3> dependencies;
 
 	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
 	dependencies[0].dstSubpass = 0;
@@ -2024,6 +2424,15 @@ void VulkanExampleBase::setupRenderPass()
 	dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
 	dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
+	// The depth attachment is shared by all frames in flight, the clear must wait for the depth tests of the previous frame
+	dependencies[2].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[2].dstSubpass = 0;
+	dependencies[2].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[2].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[2].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[2].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[2].dependencyFlags = 0;
+
 	VkRenderPassCreateInfo renderPassInfo = {};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
 	renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
@@ -2074,6 +2483,8 @@ void VulkanExampleBase::windowResize()
 	// references to the recreated frame buffer
 	destroyCommandBuffers();
 	createCommandBuffers();
+	destroySynchronizationPrimitives();
+	createSynchronizationPrimitives();
 	buildCommandBuffers();
 
 	vkDeviceWaitIdle(device);
@@ -2090,6 +2501,7 @@ void VulkanExampleBase::windowResize()
 	windowResized();
 	viewChanged();
 
+	requestFrame();
 	prepared = true;
 }
 
@@ -2104,6 +2516,8 @@ void VulkanExampleBase::initSwapchain()
 	swapChain.initSurface(windowInstance, window);
 #elif defined(__ANDROID__)	
 	swapChain.initSurface(androidApp->window);
+#elif defined(_HEADLESS)
+	// No surface (see setupSwapChain)
 #elif defined(_DIRECT2DISPLAY)
 	swapChain.initSurface(width, height);
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
@@ -2115,5 +2529,13 @@ void VulkanExampleBase::initSwapchain()
 
 void VulkanExampleBase::setupSwapChain()
 {
-	swapChain.create(&width, &height, settings.vsync);
+#if defined(_HEADLESS)
+	// The offscreen images stand in for the swap chain images (same count and format as used by the rest of the example)
+	swapChain.colorFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	swapChain.imageCount = headless.imageCount;
+	setupOffscreenTargets();
+#else
+	// Paced modes present v-synced, so frames that are never shown aren't rendered
+	swapChain.create(&width, &height, settings.vsync || framePacer.vsync());
+#endif
 }
@@ -19,6 +19,8 @@
 #include <android_native_app_glue.h>
 #include <sys/system_properties.h>
 #include "VulkanAndroid.h"
+#elif defined(_HEADLESS)
+// No window system, see the offscreen targets
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
 #include <wayland-client.h>
 #elif defined(__linux__)
@@ -46,7 +48,14 @@
 #include "VulkanDevice.hpp"
 #include "VulkanSwapChain.hpp"
 #include "VulkanTextOverlay.hpp"
+#include "VulkanFramePacer.hpp"
+#include "VulkanCallAccounting.hpp"
+#include "taskgraph.hpp"
 #include "camera.hpp"
+#if defined(_HEADLESS)
+#include "VulkanFrameBuffer.hpp"
+#include "pngwriter.hpp"
+#endif
 
 class VulkanExampleBase
 {
@@ -61,6 +70,13 @@ private:
 	uint32_t destWidth;
 	uint32_t destHeight;
 	bool resizing = false;
+	// Render on demand state (see frameRequired)
+	bool frameRequested = true;
+	bool frameSkipped = false;
+	std::chrono::high_resolution_clock::time_point lastFrameTime;
+	// Previous pass of the render loop, frameTimer and fpsTimer advance by the wall clock time between two passes
+	// (idle polls of skipped frames included), so the timers keep their pace while nothing is drawn
+	std::chrono::steady_clock::time_point lastLoopTime;
 
 protected:
     // Called if the window is resized and some resources have to be recreatesd
@@ -91,6 +107,8 @@ protected:
 	VkDevice device;
 	// Handle to the device graphics queue that command buffers are submitted to
 	VkQueue queue;
+	// Handle to the device transfer queue used for asynchronous uploads (same as queue if the device has no separate transfer family)
+	VkQueue transferQueue;
 	// Depth buffer format (selected during Vulkan initialization)
 	VkFormat depthFormat;
 	// Command buffer pool
@@ -111,6 +129,8 @@ protected:
 	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
 	// List of shader modules created (stored for cleanup)
 	std::vector<VkShaderModule> shaderModules;
+	// Shaders may be loaded from several threads during startup
+	std::mutex shaderModulesLock;
 	// Pipeline cache object
 	VkPipelineCache pipelineCache;
 	// Wraps the swap chain to present images (framebuffers) to the windowing system
@@ -124,6 +144,8 @@ protected:
 		// Text overlay submission and execution
 		VkSemaphore textOverlayComplete;
 	} semaphores;
+	// Fences signaled once all work of a frame has finished executing (one per swap chain image)
+	std::vector<VkFence> waitFences;
 public: 
 	bool prepared = false;
 	uint32_t width = 1280;
@@ -145,8 +167,26 @@ public:
 		bool fullscreen = false;
 		/** @brief Set to true if v-sync will be forced for the swapchain */
 		bool vsync = false;
+		/** @brief Only draw frames if something changed (see requestFrame), disabled with -continuous */
+		bool renderOnDemand = true;
 	} settings;
 
+	/** @brief Render on demand: a frame is drawn at least this often (in milliseconds) even if nothing changed */
+	float keepAliveInterval = 1000.0f;
+	/** @brief Render on demand: how long (in milliseconds) the idle loop waits for events before polling the application again */
+	int idlePollTimeout = 5;
+
+	/** @brief Paces the render loop (mode, target frame time and wait strategy) and collects the per frame timings */
+	vks::FramePacer framePacer;
+
+	/** @brief Counts the Vulkan calls made through the device's dispatch table per frame (enabled with -callstats or toggled at runtime) */
+	vks::CallAccounting callAccounting;
+
+	/** @brief Stages from the construction of the example up to the first frame, logged once the first frame has been submitted */
+	vks::Timeline startupTimeline;
+	/** @brief Start of the first frame on the startup timeline (negative once the timeline has been logged) */
+	double firstFrameStart = 0.0;
+
 	VkClearColorValue defaultClearColor = { { 0.0f, 0.0f, 0.0f, 0.0f } };
 
 	float zoom = 0;
@@ -163,6 +203,8 @@ public:
 
 	bool enableTextOverlay = false;
 	VulkanTextOverlay *textOverlay;
+	// Inline overlays must be drawn by the derived class at the end of its render pass (see drawTextOverlay)
+	VulkanTextOverlay::RenderMode textOverlayMode = VulkanTextOverlay::renderModeInline;
 
 	// Use to adjust mouse rotation speed
 	float rotationSpeed = 1.0f;
@@ -183,6 +225,8 @@ public:
 		VkImage image;
 		VkDeviceMemory mem;
 		VkImageView view;
+		// Transient attachment backed by lazily allocated memory (may never get physical memory on tile based GPUs)
+		bool lazilyAllocated = false;
 	} depthStencil;
 
 	// Gamepad state (only one pad supported)
@@ -209,6 +253,23 @@ public:
 	int64_t lastTapTime = 0;
 	/** @brief Product model and manufacturer of the Android device (via android.Product*) */
 	std::string androidProduct;
+#elif defined(_HEADLESS)
+	/** @brief Offscreen color images rendered in rotation instead of swap chain images */
+	std::vector<vks::Framebuffer*> offscreenTargets;
+	/** @brief Headless benchmark settings (can be changed by command line arguments) */
+	struct {
+		/** @brief Number of offscreen images (frames in flight), -images */
+		uint32_t imageCount = 3;
+		/** @brief Number of frames rendered before the render loop exits, -frames */
+		uint32_t frameCount = 1000;
+		/** @brief Write every n-th frame to a PNG file (0 disables the dumps), -dump */
+		uint32_t dumpInterval = 0;
+		/** @brief Directory the PNG files are written to, -dumpdir */
+		std::string dumpDirectory = ".";
+		/** @brief Number of frames submitted so far */
+		uint32_t submittedFrames = 0;
+	} headless;
+	bool quit = false;
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
 	wl_display *display = nullptr;
 	wl_registry *registry = nullptr;
@@ -254,6 +315,12 @@ public:
 #elif defined(__ANDROID__)
 	static int32_t handleAppInput(struct android_app* app, AInputEvent* event);
 	static void handleAppCommand(android_app* app, int32_t cmd);
+#elif defined(_HEADLESS)
+	// Create the offscreen color images that stand in for the swap chain images
+	void setupOffscreenTargets();
+	void destroyOffscreenTargets();
+	// Copy an offscreen image to the host and write it to a PNG file (waits for the queue, only used for dumps)
+	void dumpOffscreenTarget(uint32_t imageIndex, const std::string &filename);
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
 	wl_shell_surface *setupWindow();
 	void initWaylandConnection();
@@ -351,6 +418,14 @@ public:
 	// Destroy all command buffers and set their handles to VK_NULL_HANDLE
 	// May be necessary during runtime if options are toggled 
 	void destroyCommandBuffers();
+	// Create the per frame fences (signaled, as no frame is in flight yet)
+	void createSynchronizationPrimitives();
+	// Destroy the per frame fences
+	void destroySynchronizationPrimitives();
+	// Wait until all submitted frames have finished executing
+	// Only for tearing down or recreating the per frame resources: the data that changes between frames lives in per frame
+	// slots (uniform ring, instance regions), each one written once its own frame's fence has been waited on (see prepareFrame)
+	void waitForFrames();
 
 	// Command buffer creation
 	// Creates and returns a new command buffer
@@ -367,6 +442,8 @@ public:
 
 	// Load a SPIR-V shader
 	VkPipelineShaderStageCreateInfo loadShader(std::string fileName, VkShaderStageFlagBits stage);
+	// Check if a shader (or other asset) exists, e.g. before loading an optional one
+	bool assetExists(std::string fileName);
 	
 	// Start the main render loop
 	void renderLoop();
@@ -380,13 +457,27 @@ public:
 	// Can be overriden in derived class to add custom text to the overlay
 	virtual void getOverlayText(VulkanTextOverlay * textOverlay);
 
+	// Record the text overlay into the frame's render pass after the scene (inline overlay mode only, no-op otherwise)
+	// frame: swap chain image the command buffer renders to
+	void drawTextOverlay(VkCommandBuffer commandBuffer, uint32_t frame);
+
+	// Mark the next frame as required (render on demand), e.g. if the view, scene or overlay changed
+	void requestFrame();
+	// Check if a frame has to be drawn (something changed, the keep alive interval elapsed or render on demand is disabled)
+	// Called by the derived class after it polled its inputs, returns false if the frame can be skipped
+	bool frameRequired();
+
 	// Prepare the frame for workload submission
-	// - Acquires the next image from the swap chain 
+	// - Acquires the next image from the swap chain (headless: the next offscreen image)
+	// - Waits until the previous frame that used this image has finished, so its per frame resources can be updated
 	// - Sets the default wait and signal semaphores
 	bool prepareFrame();
 
 	// Submit the frames' workload 
+	// The derived class submits the scene itself, calling framePacer.beginSubmit() right before that submit
 	// - Submits the text overlay (if enabled)
+	// - Signals the frame's fence once all of its work has finished (doesn't wait for the queue)
+	// - Presents the image (headless: writes it to a PNG file if a dump is due)
 	void submitFrame();
 
 };
@@ -433,6 +524,20 @@ void android_main(android_app* state)																\
 	vulkanExample->renderLoop();																	\
 	delete(vulkanExample);																			\
 }
+#elif defined(_HEADLESS)
+// Linux entry point without window or swap chain (renders a fixed number of frames offscreen)
+#define VULKAN_EXAMPLE_MAIN()																		\
+VulkanExample *vulkanExample;																		\
+int main(const int argc, const char *argv[])													    \
+{																									\
+	for (size_t i = 0; i < argc; i++) { VulkanExample::args.push_back(argv[i]); };  				\
+	vulkanExample = new VulkanExample();															\
+	vulkanExample->initVulkan();																	\
+	vulkanExample->prepare();																		\
+	vulkanExample->renderLoop();																	\
+	delete(vulkanExample);																			\
+	return 0;																						\
+}
 #elif defined(_DIRECT2DISPLAY)
 // Linux entry point with direct to display wsi
 #define VULKAN_EXAMPLE_MAIN()																		\
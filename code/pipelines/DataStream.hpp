@@ -5,18 +5,44 @@
 #ifndef PIPELINES_DATASTREAM_H
 #define PIPELINES_DATASTREAM_H
 #include <sys/socket.h>
-#include <android/log.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <thread>
 #include <queue>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
 #include "TraceTime.hpp"
+#include "PointFrame.hpp"
 float XOFF = 800;
 float YOFF = 2200;
 float ZOFF = -230;
 
+// How the points of a stream should be drawn, chosen by the source of the stream
+enum StreamRenderMode{
+    // meshes, or impostors once there are too many points for meshes
+    STREAM_RENDER_AUTO,
+    // the full lit mesh per point
+    STREAM_RENDER_MESH,
+    // a sphere impostor per point, for dense point clouds
+    STREAM_RENDER_IMPOSTOR
+};
+
 class Frame{
 public:
     bool valid = false;
-    std::vector<float> points;
+    PointFrame points;
+    StreamRenderMode renderMode = STREAM_RENDER_AUTO;
+    // when the frame was queued for rendering, used to interpolate between frames
+    std::chrono::steady_clock::time_point arrival;
+
+    explicit Frame(size_t capacity = 0, uint32_t channels = 0) : points(capacity, channels){
+    }
+
+    // convert the points from the normalized coordinates of the Jitter matrix, once the frame has been decoded
+    void toWorld(){
+        points.scaleOffset(944.88f, XOFF, YOFF, ZOFF);
+    }
 };
 
 class Frames{
@@ -45,6 +71,7 @@ public:
     }
 
     void saveFrame(Frame * frame){
+        frame->arrival = std::chrono::steady_clock::now();
         std::lock_guard<std::mutex> lock(m_);
         frames.push(frame);
         // delete frames if rendering is too slow
@@ -58,6 +85,12 @@ public:
         return frameCounter;
     }
 
+    // number of frames waiting to be rendered
+    int size(){
+        std::lock_guard<std::mutex> lock(m_);
+        return frames.size();
+    }
+
 };
 
 Frames frames;
@@ -107,11 +140,12 @@ private:
 
     // read large amount of data,
     // the buffer must be large enough to store the data of the "size"
+    // works on sockets and on files (recorded streams)
     int read(int client_socket, char * buffer, int size){
         int bytesRead = 0;
         int result = 0;
         while(bytesRead < size){
-            result = recv(client_socket, buffer + bytesRead, size - bytesRead, 0);
+            result = ::read(client_socket, buffer + bytesRead, size - bytesRead);
             if(result < 1){
                 return -1;
             }
@@ -243,28 +277,33 @@ public:
             case 2:{
                 int width = dim[0];
                 int height = dim[1];
-                Frame * frame = new Frame();
+                // planes: x, y, z and optionally the id of the point (matches the point across frames, instead of its index)
+                // and the type of its mesh
+                bool ids = planeCount >= 4;
+                bool meshes = planeCount >= 5;
+                Frame * frame = new Frame(width * height, (ids ? POINT_CHANNEL_ID : 0) | (meshes ? POINT_CHANNEL_MESH : 0));
+                PointFrame &points = frame->points;
+                points.resize(width * height);
+                int n = 0;
                 for(int i = 0; i < height; i++){
                     char * bp = buffer + i * dimStride[1];
                     int offset = 0;
                     for(int j = 0; j < width; j++){
-                        float Xvalue = getFloat(bp, offset);
-                        float Yvalue = getFloat(bp, offset);
-                        float Zvalue = 1.0f-getFloat(bp, offset);
-
-                        Xvalue *= 944.88;
-                        Yvalue *= 944.88;
-                        Zvalue *= 944.88;
-                        Xvalue += XOFF;//800;
-                        Yvalue += YOFF;//700;
-                        Zvalue += ZOFF;//0;
-
-                        frame->points.push_back(Xvalue);
-                        frame->points.push_back(Yvalue);
-                        frame->points.push_back(Zvalue);
-
+                        points.x[n] = getFloat(bp, offset);
+                        points.y[n] = getFloat(bp, offset);
+                        points.z[n] = 1.0f-getFloat(bp, offset);
+                        if(ids){
+                            points.id[n] = (uint32_t)getFloat(bp, offset);
+                        }
+                        if(meshes){
+                            points.mesh[n] = (uint32_t)getFloat(bp, offset);
+                        }
+                        // skip the remaining planes
+                        offset += std::max(planeCount - 5, 0) * 4;
+                        n++;
                     }
                 }
+                frame->toWorld();
                 return frame;
             }
 
@@ -286,9 +325,16 @@ private:
     int client_skt= -1;
     bool running = false;
     int port = 7888;
+    // render mode of the received stream
+    StreamRenderMode renderMode = STREAM_RENDER_AUTO;
 
 public:
 
+    // render mode of the frames received from now on
+    void setRenderMode(StreamRenderMode mode){
+        renderMode = mode;
+    }
+
     bool setupSocket(){
         // sending end
         server_skt = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
@@ -350,6 +396,7 @@ public:
 //        long startTime = getCurrentTimeMillis();
         Frame * frame = reader.readFrame(client_skt);
         if(frame != nullptr){
+            frame->renderMode = renderMode;
             frames.saveFrame(frame);
             // TODO:
 //            int time = getCurrentTimeMillis() - startTime;
@@ -399,4 +446,107 @@ void stopServer(){
     server.stop();
 }
 
+// Feeds frames without a network connection, for headless benchmarking.
+// Plays either a recorded stream (the raw bytes the server receives, e.g. captured with "nc -l 7888 > stream.jit")
+// in a loop, or a synthetic grid of points moving as a wave.
+class StreamPlayer{
+private:
+    std::string recordPath;
+    // synthetic stream: gridSize x gridSize points
+    int gridSize = 32;
+    // number of mesh types the synthetic points cycle through, 1 leaves the mesh channel out
+    int meshTypes = 1;
+    // frames per second, 0 keeps one frame queued so every rendered frame gets new data
+    float rate = 0.0f;
+    bool running = false;
+    std::thread thread;
+    int frameIndex = 0;
+    StreamRenderMode renderMode = STREAM_RENDER_AUTO;
+
+    Frame * syntheticFrame(){
+        Frame * frame = new Frame(gridSize * gridSize, meshTypes > 1 ? POINT_CHANNEL_MESH : 0);
+        float phase = frameIndex * 0.1f;
+        for(int i = 0; i < gridSize; i++){
+            for(int j = 0; j < gridSize; j++){
+                float x = (float)j / gridSize - 0.5f;
+                float y = (float)i / gridSize - 0.5f;
+                float z = 0.05f * sinf(x * 12.0f + phase) * cosf(y * 12.0f + phase);
+                frame->points.push(x, y, 1.0f - z);
+                if(meshTypes > 1){
+                    frame->points.mesh[frame->points.size() - 1] = (uint32_t)((i + j) % meshTypes);
+                }
+            }
+        }
+        frame->toWorld();
+        return frame;
+    }
+
+    void play(){
+        int file = -1;
+        if(!recordPath.empty()){
+            file = open(recordPath.c_str(), O_RDONLY);
+            if(file == -1){
+                __android_log_print(ANDROID_LOG_ERROR, "Test","Could not open the recorded stream %s, playing a synthetic one.", recordPath.c_str());
+            }
+        }
+        JitNetReader reader;
+        bool framesInPass = false;
+        auto next = std::chrono::steady_clock::now();
+        while(running){
+            if(rate > 0.0f){
+                std::this_thread::sleep_until(next);
+                next += std::chrono::microseconds((long long)(1000000.0f / rate));
+            }else if(frames.size() > 0){
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+
+            Frame * frame = nullptr;
+            if(file != -1){
+                frame = reader.readFrame(file);
+                if(frame == nullptr){
+                    // end of the recording, play it again
+                    if(!framesInPass){
+                        __android_log_print(ANDROID_LOG_ERROR, "Test","No frames in the recorded stream %s.", recordPath.c_str());
+                        break;
+                    }
+                    framesInPass = false;
+                    lseek(file, 0, SEEK_SET);
+                    continue;
+                }
+                framesInPass = true;
+            }else{
+                frame = syntheticFrame();
+            }
+            frame->renderMode = renderMode;
+            frames.saveFrame(frame);
+            frameIndex++;
+        }
+        if(file != -1){
+            close(file);
+        }
+    }
+
+public:
+
+    // recordPath: recorded stream to play, synthetic stream if empty
+    void start(std::string recordPath, int gridSize, float rate, StreamRenderMode renderMode = STREAM_RENDER_AUTO, int meshTypes = 1){
+        this->recordPath = recordPath;
+        this->gridSize = gridSize;
+        this->meshTypes = meshTypes;
+        this->rate = rate;
+        this->renderMode = renderMode;
+        running = true;
+        thread = std::thread(&StreamPlayer::play, this);
+    }
+
+    void stop(){
+        running = false;
+        if(thread.joinable()){
+            thread.join();
+        }
+    }
+
+};
+
 #endif //PIPELINES_DATASTREAM_H
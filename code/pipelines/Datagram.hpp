@@ -9,7 +9,7 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 //#include <unistd.h>
-#include <android/log.h>
+#include "TraceTime.hpp"
 #include <unistd.h>
 #include "protocol.hpp"
 #include <thread>
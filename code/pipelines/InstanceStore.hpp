@@ -0,0 +1,318 @@
+//
+// Slot map of the streamed instances
+//
+
+#ifndef PIPELINES_INSTANCESTORE_H
+#define PIPELINES_INSTANCESTORE_H
+
+#include <stdint.h>
+#include <assert.h>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+// Range of consecutive instances
+struct InstanceRange{
+    uint32_t first;
+    uint32_t count;
+};
+
+// Handle of an instance, stays valid until that instance is removed, no matter how many others are added or removed
+struct InstanceHandle{
+    uint32_t slot = 0xFFFFFFFF;
+    uint32_t generation = 0;
+};
+
+// The data of the instances is kept dense, in the order it's uploaded and drawn. Handles point at slots that hold the
+// dense index of their instance, so adding and removing are O(1): removing moves the last instance into the hole and
+// only updates the slot of the moved one. A removed slot is reused with a new generation, so stale handles are detected.
+// Per instance state kept in the dense arrays (interpolation history, ...) survives changes of the point count.
+// The dense order is partitioned into buckets (e.g. per mesh type and level of detail): the instances of each bucket are
+// consecutive, so every bucket can be drawn with one instanced draw. Changing the bucket of an instance swaps it across
+// the bucket boundaries (one swap per bucket in between), new instances start in the last bucket.
+class InstanceStore{
+public:
+    // per instance: previous position (xyz), current position (xyz)
+    static const uint32_t instanceFloats = 6;
+
+    // dense arrays, indexed by the instance index
+    std::vector<float> data;
+    // id of the point in the stream
+    std::vector<uint32_t> pointIds;
+    // number of the last stream frame the point was part of
+    std::vector<uint32_t> lastSeen;
+    // bucket of each instance
+    std::vector<uint16_t> bucket;
+
+    // upper limit of setFrameCount
+    static const uint32_t maxFrames = 8;
+
+    // instances changed since the last clearDirty of a frame (added, moved, or moved into the place of a removed one)
+    // one bit per frame, every frame keeps its own copy of the instances (e.g. per frame in flight) and catches up separately
+    std::vector<uint8_t> dirty;
+    uint32_t dirtyCount[maxFrames] = {};
+
+    uint32_t size() const{
+        return static_cast<uint32_t>(pointIds.size());
+    }
+
+    uint32_t frameCount() const{
+        return frames;
+    }
+
+    // number of frames that track their dirty instances, all instances are dirty for all frames afterwards
+    void setFrameCount(uint32_t count){
+        assert(count > 0 && count <= maxFrames);
+        frames = count;
+        markAllDirty();
+    }
+
+    uint32_t bucketCount() const{
+        return static_cast<uint32_t>(bucketStart.size());
+    }
+
+    // number of buckets, only while the store is empty
+    void setBucketCount(uint32_t count){
+        assert(size() == 0 && count > 0 && count <= 0xFFFF);
+        bucketStart.assign(count, 0);
+    }
+
+    // instances of a bucket
+    InstanceRange bucketRange(uint32_t target) const{
+        uint32_t end = (target + 1 < bucketCount()) ? bucketStart[target + 1] : size();
+        InstanceRange range = { bucketStart[target], end - bucketStart[target] };
+        return range;
+    }
+
+    // move an instance to another bucket, returns its new index
+    // the instances it's swapped with are marked dirty too
+    uint32_t setBucket(uint32_t index, uint32_t target){
+        assert(target < bucketCount());
+        uint32_t current = bucket[index];
+        while(current < target){
+            // swap with the last instance of the bucket and move the boundary in front of it
+            uint32_t last = bucketStart[current + 1] - 1;
+            swap(index, last);
+            index = last;
+            bucketStart[current + 1]--;
+            current++;
+        }
+        while(current > target){
+            // swap with the first instance of the bucket and move the boundary behind it
+            uint32_t first = bucketStart[current];
+            swap(index, first);
+            index = first;
+            bucketStart[current]++;
+            current--;
+        }
+        bucket[index] = static_cast<uint16_t>(target);
+        return index;
+    }
+
+    bool valid(InstanceHandle handle) const{
+        return handle.slot < slots.size() && slots[handle.slot].generation == handle.generation && slots[handle.slot].index != invalid;
+    }
+
+    // dense index of a valid handle
+    uint32_t index(InstanceHandle handle) const{
+        assert(valid(handle));
+        return slots[handle.slot].index;
+    }
+
+    // handle of the instance at a dense index
+    InstanceHandle handle(uint32_t index) const{
+        InstanceHandle handle;
+        handle.slot = denseSlots[index];
+        handle.generation = slots[handle.slot].generation;
+        return handle;
+    }
+
+    // handle of the instance of a point, invalid if the point has no instance
+    InstanceHandle find(uint32_t pointId) const{
+        auto it = slotsById.find(pointId);
+        if(it == slotsById.end()){
+            return InstanceHandle();
+        }
+        InstanceHandle handle;
+        handle.slot = it->second;
+        handle.generation = slots[it->second].generation;
+        return handle;
+    }
+
+    float * instance(uint32_t index){
+        return &data[index * instanceFloats];
+    }
+
+    // add an instance for a point at a position (without a previous position to move from)
+    InstanceHandle add(uint32_t pointId, float x, float y, float z){
+        uint32_t slot;
+        if(!freeSlots.empty()){
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }else{
+            slot = static_cast<uint32_t>(slots.size());
+            slots.push_back(Slot());
+        }
+        uint32_t index = size();
+        slots[slot].index = index;
+        denseSlots.push_back(slot);
+        pointIds.push_back(pointId);
+        lastSeen.push_back(0);
+        bucket.push_back(static_cast<uint16_t>(bucketCount() - 1));
+        dirty.push_back(0);
+        const float values[instanceFloats] = { x, y, z, x, y, z };
+        data.insert(data.end(), values, values + instanceFloats);
+        slotsById[pointId] = slot;
+        markDirty(index);
+
+        InstanceHandle handle;
+        handle.slot = slot;
+        handle.generation = slots[slot].generation;
+        return handle;
+    }
+
+    // remove an instance, the last instance takes its place (after moving it to the last bucket, which ends with the last instance)
+    void remove(InstanceHandle handle){
+        uint32_t index = setBucket(this->index(handle), bucketCount() - 1);
+        uint32_t last = size() - 1;
+        auto it = slotsById.find(pointIds[index]);
+        if(it != slotsById.end() && it->second == handle.slot){
+            slotsById.erase(it);
+        }
+        if(index != last){
+            std::copy(instance(last), instance(last) + instanceFloats, instance(index));
+            pointIds[index] = pointIds[last];
+            lastSeen[index] = lastSeen[last];
+            bucket[index] = bucket[last];
+            denseSlots[index] = denseSlots[last];
+            slots[denseSlots[index]].index = index;
+            markDirty(index);
+        }
+        for(uint32_t frame = 0; frame < frames; frame++){
+            if(dirty[last] & (1u << frame)){
+                dirtyCount[frame]--;
+            }
+        }
+        data.resize(last * instanceFloats);
+        pointIds.pop_back();
+        lastSeen.pop_back();
+        bucket.pop_back();
+        dirty.pop_back();
+        denseSlots.pop_back();
+
+        slots[handle.slot].index = invalid;
+        slots[handle.slot].generation++;
+        freeSlots.push_back(handle.slot);
+    }
+
+    // dirty for all frames
+    void markDirty(uint32_t index){
+        uint8_t added = allFrames() & ~dirty[index];
+        if(added == 0){
+            return;
+        }
+        for(uint32_t frame = 0; frame < frames; frame++){
+            if(added & (1u << frame)){
+                dirtyCount[frame]++;
+            }
+        }
+        dirty[index] |= added;
+    }
+
+    // every instance dirty for all frames (e.g. their copies of the instances were lost)
+    void markAllDirty(){
+        std::fill(dirty.begin(), dirty.end(), allFrames());
+        std::fill(dirtyCount, dirtyCount + maxFrames, 0);
+        std::fill(dirtyCount, dirtyCount + frames, size());
+    }
+
+    void clearDirty(uint32_t frame){
+        assert(frame < frames);
+        if(dirtyCount[frame] == 0){
+            return;
+        }
+        const uint8_t mask = static_cast<uint8_t>(~(1u << frame));
+        for(auto &flags : dirty){
+            flags &= mask;
+        }
+        dirtyCount[frame] = 0;
+    }
+
+    // Collect the dirty instances of a frame as ranges in ascending order
+    // Ranges separated by at most mergeGap clean instances are merged (re-sending a few clean instances is cheaper than
+    // another copy region), the gap is widened until there are at most maxRanges
+    void dirtyRanges(std::vector<InstanceRange> &ranges, uint32_t mergeGap, uint32_t maxRanges, uint32_t frame) const{
+        assert(frame < frames);
+        ranges.clear();
+        if(dirtyCount[frame] == 0){
+            return;
+        }
+        const uint8_t bit = static_cast<uint8_t>(1u << frame);
+        for(uint32_t i = 0; i < size(); i++){
+            if(!(dirty[i] & bit)){
+                continue;
+            }
+            if(!ranges.empty() && i - (ranges.back().first + ranges.back().count) <= mergeGap){
+                ranges.back().count = i + 1 - ranges.back().first;
+            }else{
+                InstanceRange range = { i, 1 };
+                ranges.push_back(range);
+            }
+        }
+        while(ranges.size() > std::max(maxRanges, 1u)){
+            mergeGap = std::max(mergeGap * 2, 1u);
+            size_t merged = 0;
+            for(size_t i = 1; i < ranges.size(); i++){
+                InstanceRange &previous = ranges[merged];
+                if(ranges[i].first - (previous.first + previous.count) <= mergeGap){
+                    previous.count = ranges[i].first + ranges[i].count - previous.first;
+                }else{
+                    ranges[++merged] = ranges[i];
+                }
+            }
+            ranges.resize(merged + 1);
+        }
+    }
+
+private:
+    static const uint32_t invalid = 0xFFFFFFFF;
+
+    struct Slot{
+        uint32_t index = invalid;
+        uint32_t generation = 0;
+    };
+
+    // see setFrameCount
+    uint32_t frames = 1;
+
+    uint8_t allFrames() const{
+        return static_cast<uint8_t>((1u << frames) - 1);
+    }
+
+    // first instance of each bucket
+    std::vector<uint32_t> bucketStart = std::vector<uint32_t>(1, 0);
+
+    std::vector<Slot> slots;
+    // slot of each dense instance
+    std::vector<uint32_t> denseSlots;
+    std::vector<uint32_t> freeSlots;
+    std::unordered_map<uint32_t, uint32_t> slotsById;
+
+    // swap two instances (including their buckets), both are marked dirty
+    void swap(uint32_t a, uint32_t b){
+        if(a == b){
+            return;
+        }
+        std::swap_ranges(instance(a), instance(a) + instanceFloats, instance(b));
+        std::swap(pointIds[a], pointIds[b]);
+        std::swap(lastSeen[a], lastSeen[b]);
+        std::swap(bucket[a], bucket[b]);
+        std::swap(denseSlots[a], denseSlots[b]);
+        slots[denseSlots[a]].index = a;
+        slots[denseSlots[b]].index = b;
+        markDirty(a);
+        markDirty(b);
+    }
+};
+
+#endif //PIPELINES_INSTANCESTORE_H
@@ -0,0 +1,345 @@
+// Import time mesh optimization: vertex welding, post-transform vertex cache and vertex fetch ordering, LOD simplification
+// Works on the imported float vertices (any layout, floatStride floats per vertex) and 32 bit triangle list indices
+
+#ifndef PIPELINES_MESH_OPTIMIZER_HPP
+#define PIPELINES_MESH_OPTIMIZER_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <float.h>
+
+namespace vks
+{
+namespace meshopt
+{
+    // Size of the simulated post-transform cache (FIFO), a conservative size for mobile GPUs
+    const uint32_t defaultCacheSize = 16;
+
+    // Average cache miss ratio: transformed vertices per triangle with a FIFO cache of cacheSize entries
+    // 3.0 is the worst case (no reuse), ~0.5 is the limit for large regular meshes
+    inline float acmr(const std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize = defaultCacheSize)
+    {
+        if (indices.size() < 3) {
+            return 0.0f;
+        }
+        // Time stamp of the vertex's entry into the cache, it's still in the cache if fewer than cacheSize misses happened since
+        std::vector<uint32_t> cached(vertexCount, 0);
+        uint32_t misses = 0;
+        for (auto index : indices) {
+            if (cached[index] == 0 || misses - cached[index] + 1 > cacheSize) {
+                misses++;
+                cached[index] = misses;
+            }
+        }
+        return static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+    }
+
+    // Merge vertices with identical data, returns the new vertex count
+    // The relative order of the remaining vertices is kept
+    inline uint32_t weldVertices(std::vector<float> &vertices, uint32_t floatStride, std::vector<uint32_t> &indices)
+    {
+        const uint32_t vertexCount = static_cast<uint32_t>(vertices.size() / floatStride);
+        const size_t vertexSize = floatStride * sizeof(float);
+        const float *data = vertices.data();
+
+        // Sort the vertices by their data, identical vertices end up next to each other
+        std::vector<uint32_t> order(vertexCount);
+        for (uint32_t i = 0; i < vertexCount; i++) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            int result = memcmp(data + a * floatStride, data + b * floatStride, vertexSize);
+            return (result < 0) || (result == 0 && a < b);
+        });
+
+        // Every vertex is replaced by the first (lowest index) vertex with the same data
+        std::vector<uint32_t> representative(vertexCount);
+        for (uint32_t i = 0; i < vertexCount; i++) {
+            bool duplicate = (i > 0) && (memcmp(data + order[i] * floatStride, data + order[i - 1] * floatStride, vertexSize) == 0);
+            representative[order[i]] = duplicate ? representative[order[i - 1]] : order[i];
+        }
+
+        std::vector<uint32_t> remap(vertexCount);
+        std::vector<float> welded;
+        welded.reserve(vertices.size());
+        uint32_t weldedCount = 0;
+        for (uint32_t i = 0; i < vertexCount; i++) {
+            if (representative[i] == i) {
+                remap[i] = weldedCount++;
+                welded.insert(welded.end(), data + i * floatStride, data + (i + 1) * floatStride);
+            } else {
+                remap[i] = remap[representative[i]];
+            }
+        }
+        for (auto &index : indices) {
+            index = remap[index];
+        }
+        vertices.swap(welded);
+        return weldedCount;
+    }
+
+    // Reorder the triangles for the post-transform vertex cache
+    // Tipsify (Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007), linear in the index count
+    inline void optimizeVertexCache(std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize = defaultCacheSize)
+    {
+        const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+        if (triangleCount == 0) {
+            return;
+        }
+
+        // Triangles using each vertex (compressed adjacency lists)
+        std::vector<uint32_t> liveTriangles(vertexCount, 0);
+        for (auto index : indices) {
+            liveTriangles[index]++;
+        }
+        std::vector<uint32_t> adjacencyOffset(vertexCount + 1, 0);
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            adjacencyOffset[v + 1] = adjacencyOffset[v] + liveTriangles[v];
+        }
+        std::vector<uint32_t> adjacency(indices.size());
+        {
+            std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+            for (uint32_t t = 0; t < triangleCount; t++) {
+                for (uint32_t k = 0; k < 3; k++) {
+                    adjacency[fill[indices[t * 3 + k]]++] = t;
+                }
+            }
+        }
+
+        std::vector<uint32_t> cacheTime(vertexCount, 0);
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<uint32_t> deadEnd;
+        std::vector<uint32_t> candidates;
+        std::vector<uint32_t> output;
+        output.reserve(indices.size());
+
+        uint32_t time = cacheSize + 1;
+        uint32_t cursor = 0;
+        int32_t fanning = 0;
+
+        while (fanning >= 0) {
+            // Emit all remaining triangles of the fanning vertex
+            candidates.clear();
+            for (uint32_t a = adjacencyOffset[fanning]; a < adjacencyOffset[fanning + 1]; a++) {
+                uint32_t t = adjacency[a];
+                if (emitted[t]) {
+                    continue;
+                }
+                for (uint32_t k = 0; k < 3; k++) {
+                    uint32_t v = indices[t * 3 + k];
+                    output.push_back(v);
+                    deadEnd.push_back(v);
+                    candidates.push_back(v);
+                    liveTriangles[v]--;
+                    if (time - cacheTime[v] > cacheSize) {
+                        cacheTime[v] = time++;
+                    }
+                }
+                emitted[t] = true;
+            }
+
+            // Next fanning vertex: the candidate with live triangles that stays in the cache the longest
+            int32_t next = -1;
+            int32_t bestPriority = -1;
+            for (auto v : candidates) {
+                if (liveTriangles[v] == 0) {
+                    continue;
+                }
+                int32_t priority = 0;
+                if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+                    priority = static_cast<int32_t>(time - cacheTime[v]);
+                }
+                if (priority > bestPriority) {
+                    bestPriority = priority;
+                    next = static_cast<int32_t>(v);
+                }
+            }
+
+            if (next < 0) {
+                // Dead end: go back to a recently used vertex with live triangles, otherwise the next one in index order
+                while (!deadEnd.empty()) {
+                    uint32_t v = deadEnd.back();
+                    deadEnd.pop_back();
+                    if (liveTriangles[v] > 0) {
+                        next = static_cast<int32_t>(v);
+                        break;
+                    }
+                }
+                while (next < 0 && cursor < vertexCount) {
+                    if (liveTriangles[cursor] > 0) {
+                        next = static_cast<int32_t>(cursor);
+                    }
+                    cursor++;
+                }
+            }
+            fanning = next;
+        }
+
+        indices.swap(output);
+    }
+
+    // Reorder the vertices by their first use in the index buffer so the vertex fetch walks the buffer linearly
+    // Unreferenced vertices are dropped, returns the new vertex count
+    inline uint32_t optimizeVertexFetch(std::vector<float> &vertices, uint32_t floatStride, std::vector<uint32_t> &indices)
+    {
+        const uint32_t vertexCount = static_cast<uint32_t>(vertices.size() / floatStride);
+        const uint32_t unused = 0xFFFFFFFF;
+        std::vector<uint32_t> remap(vertexCount, unused);
+        std::vector<float> reordered;
+        reordered.reserve(vertices.size());
+        uint32_t fetchedCount = 0;
+        for (auto &index : indices) {
+            if (remap[index] == unused) {
+                remap[index] = fetchedCount++;
+                reordered.insert(reordered.end(), vertices.begin() + index * floatStride, vertices.begin() + (index + 1) * floatStride);
+            }
+            index = remap[index];
+        }
+        vertices.swap(reordered);
+        return fetchedCount;
+    }
+
+    // Simplify a mesh by vertex clustering: the positions are snapped to a grid of gridSize^3 cells over their bounds, all
+    // vertices of a cell collapse into the one closest to the cell's mean, triangles with collapsed corners are dropped
+    // The result indexes the same vertices (no new vertex data), so all levels of a mesh can share one vertex buffer
+    // positionOffset: float offset of the position in a vertex
+    inline std::vector<uint32_t> simplifyClusters(const std::vector<float> &vertices, uint32_t floatStride, uint32_t positionOffset,
+                                                  const std::vector<uint32_t> &indices, uint32_t gridSize)
+    {
+        const uint32_t vertexCount = static_cast<uint32_t>(vertices.size() / floatStride);
+        std::vector<uint32_t> simplified;
+        if (indices.empty() || gridSize == 0) {
+            return simplified;
+        }
+
+        float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (auto index : indices) {
+            const float *position = vertices.data() + index * floatStride + positionOffset;
+            for (uint32_t k = 0; k < 3; k++) {
+                min[k] = std::min(min[k], position[k]);
+                max[k] = std::max(max[k], position[k]);
+            }
+        }
+        float cellScale[3];
+        for (uint32_t k = 0; k < 3; k++) {
+            float extent = max[k] - min[k];
+            cellScale[k] = (extent > 0.0f) ? static_cast<float>(gridSize) / extent : 0.0f;
+        }
+
+        // Cell of each vertex, and the mean position of each occupied cell
+        const uint32_t unused = 0xFFFFFFFF;
+        std::vector<uint32_t> cellOfVertex(vertexCount, unused);
+        std::vector<uint32_t> cellIds;
+        std::vector<float> cellMeans;
+        std::vector<uint32_t> cellCounts;
+        {
+            std::vector<uint32_t> cellIndex(static_cast<size_t>(gridSize) * gridSize * gridSize, unused);
+            for (auto index : indices) {
+                if (cellOfVertex[index] != unused) {
+                    continue;
+                }
+                const float *position = vertices.data() + index * floatStride + positionOffset;
+                uint32_t cell = 0;
+                for (uint32_t k = 0; k < 3; k++) {
+                    uint32_t c = std::min(static_cast<uint32_t>((position[k] - min[k]) * cellScale[k]), gridSize - 1);
+                    cell = cell * gridSize + c;
+                }
+                if (cellIndex[cell] == unused) {
+                    cellIndex[cell] = static_cast<uint32_t>(cellCounts.size());
+                    cellCounts.push_back(0);
+                    cellMeans.insert(cellMeans.end(), 3, 0.0f);
+                }
+                uint32_t id = cellIndex[cell];
+                cellOfVertex[index] = id;
+                cellCounts[id]++;
+                for (uint32_t k = 0; k < 3; k++) {
+                    cellMeans[id * 3 + k] += position[k];
+                }
+            }
+        }
+        for (size_t id = 0; id < cellCounts.size(); id++) {
+            for (uint32_t k = 0; k < 3; k++) {
+                cellMeans[id * 3 + k] /= static_cast<float>(cellCounts[id]);
+            }
+        }
+
+        // Representative of each cell: its vertex closest to the mean
+        std::vector<uint32_t> representative(cellCounts.size(), unused);
+        std::vector<float> representativeDistance(cellCounts.size(), FLT_MAX);
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            uint32_t id = cellOfVertex[v];
+            if (id == unused) {
+                continue;
+            }
+            const float *position = vertices.data() + v * floatStride + positionOffset;
+            float distance = 0.0f;
+            for (uint32_t k = 0; k < 3; k++) {
+                float d = position[k] - cellMeans[id * 3 + k];
+                distance += d * d;
+            }
+            if (distance < representativeDistance[id]) {
+                representativeDistance[id] = distance;
+                representative[id] = v;
+            }
+        }
+
+        // Collapsed triangles, rotated to start with their lowest index (keeps the winding) so duplicates compare equal
+        struct Triangle {
+            uint32_t v[3];
+            bool operator<(const Triangle &other) const {
+                return std::lexicographical_compare(v, v + 3, other.v, other.v + 3);
+            }
+            bool operator==(const Triangle &other) const {
+                return std::equal(v, v + 3, other.v);
+            }
+        };
+        std::vector<Triangle> triangles;
+        triangles.reserve(indices.size() / 3);
+        for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+            uint32_t a = representative[cellOfVertex[indices[t]]];
+            uint32_t b = representative[cellOfVertex[indices[t + 1]]];
+            uint32_t c = representative[cellOfVertex[indices[t + 2]]];
+            if (a == b || b == c || a == c) {
+                continue;
+            }
+            Triangle triangle = { { a, b, c } };
+            std::rotate(triangle.v, std::min_element(triangle.v, triangle.v + 3), triangle.v + 3);
+            triangles.push_back(triangle);
+        }
+        std::sort(triangles.begin(), triangles.end());
+        triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+
+        simplified.reserve(triangles.size() * 3);
+        for (auto &triangle : triangles) {
+            simplified.insert(simplified.end(), triangle.v, triangle.v + 3);
+        }
+        return simplified;
+    }
+
+    struct Statistics {
+        uint32_t verticesBefore = 0;
+        uint32_t verticesAfter = 0;
+        float acmrBefore = 0.0f;
+        float acmrAfter = 0.0f;
+    };
+
+    // Run all passes on a mesh: weld, vertex cache order, vertex fetch order
+    inline Statistics optimize(std::vector<float> &vertices, uint32_t floatStride, std::vector<uint32_t> &indices, uint32_t cacheSize = defaultCacheSize)
+    {
+        Statistics statistics;
+        statistics.verticesBefore = static_cast<uint32_t>(vertices.size() / floatStride);
+        statistics.acmrBefore = acmr(indices, statistics.verticesBefore, cacheSize);
+
+        uint32_t vertexCount = weldVertices(vertices, floatStride, indices);
+        optimizeVertexCache(indices, vertexCount, cacheSize);
+        statistics.verticesAfter = optimizeVertexFetch(vertices, floatStride, indices);
+        statistics.acmrAfter = acmr(indices, statistics.verticesAfter, cacheSize);
+        return statistics;
+    }
+}
+}
+
+#endif
@@ -0,0 +1,181 @@
+//
+// Structure of arrays storage for the points of a frame
+//
+
+#ifndef PIPELINES_POINTFRAME_H
+#define PIPELINES_POINTFRAME_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+// Tells the compiler a pointer is aligned, so loops over it vectorize without a peeling prologue (a no-op where there is no builtin)
+#if defined(__GNUC__) || defined(__clang__)
+#define ASSUME_ALIGNED(pointer, alignment) __builtin_assume_aligned((pointer), (alignment))
+#else
+#define ASSUME_ALIGNED(pointer, alignment) (pointer)
+#endif
+
+// aligned_alloc needs C++17 and Android API 28, posix_memalign is available from API 16
+inline void * alignedMalloc(size_t alignment, size_t size){
+#if defined(_MSC_VER)
+    return _aligned_malloc(size, alignment);
+#else
+    void * data = nullptr;
+    return (posix_memalign(&data, alignment, size) == 0) ? data : nullptr;
+#endif
+}
+
+inline void alignedFree(void * data){
+#if defined(_MSC_VER)
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+// Allocator for std::vector that aligns the data, e.g. to the cache line so vector loads never split a line
+template<typename T, size_t Alignment>
+struct AlignedAllocator{
+    typedef T value_type;
+
+    template<typename U> struct rebind{
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator(){}
+    template<typename U> AlignedAllocator(const AlignedAllocator<U, Alignment> &){}
+
+    T * allocate(size_t n){
+        void * data = alignedMalloc(Alignment, n * sizeof(T));
+        if(data == nullptr){
+            // out of memory, there is nothing sensible to continue with
+            abort();
+        }
+        return static_cast<T *>(data);
+    }
+
+    void deallocate(T * data, size_t){
+        alignedFree(data);
+    }
+
+    template<typename U> bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template<typename U> bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+// Optional per point attributes
+enum PointChannel{
+    POINT_CHANNEL_COLOR = 0x1,  // RGBA8
+    POINT_CHANNEL_SCALE = 0x2,
+    POINT_CHANNEL_ID = 0x4,
+    // type of the mesh drawn for the point (index of the mesh registry)
+    POINT_CHANNEL_MESH = 0x8
+};
+
+// Points of a frame as separate x, y and z arrays (plus the enabled attribute channels) instead of interleaved xyz triples
+// Every array is 64 byte aligned and its length is padded to a multiple of lanes, so loops over paddedSize() vectorize
+// without gathers or a scalar tail. Elements past size() are padding: they can be read and written, their values are meaningless.
+class PointFrame{
+public:
+    static const size_t alignment = 64;
+    // floats per 64 bytes, the widest vector a loop over the arrays is expected to use
+    static const size_t lanes = alignment / sizeof(float);
+
+    typedef std::vector<float, AlignedAllocator<float, alignment> > Floats;
+    typedef std::vector<uint32_t, AlignedAllocator<uint32_t, alignment> > Uints;
+
+    Floats x;
+    Floats y;
+    Floats z;
+    // only sized if their channel is enabled
+    Uints color;
+    Floats scale;
+    Uints id;
+    Uints mesh;
+
+    explicit PointFrame(size_t capacity = 0, uint32_t channels = 0) : channels(channels){
+        reserve(capacity);
+    }
+
+    static size_t padded(size_t count){
+        return (count + lanes - 1) / lanes * lanes;
+    }
+
+    bool has(PointChannel channel) const{
+        return (channels & channel) != 0;
+    }
+
+    size_t size() const{
+        return count;
+    }
+
+    size_t paddedSize() const{
+        return x.size();
+    }
+
+    // reserve room for capacity points, push and resize don't reallocate below it
+    void reserve(size_t capacity){
+        size_t paddedCapacity = padded(capacity);
+        x.reserve(paddedCapacity);
+        y.reserve(paddedCapacity);
+        z.reserve(paddedCapacity);
+        if(has(POINT_CHANNEL_COLOR)) color.reserve(paddedCapacity);
+        if(has(POINT_CHANNEL_SCALE)) scale.reserve(paddedCapacity);
+        if(has(POINT_CHANNEL_ID)) id.reserve(paddedCapacity);
+        if(has(POINT_CHANNEL_MESH)) mesh.reserve(paddedCapacity);
+    }
+
+    // set the number of points, e.g. before a decoder writes the arrays directly
+    void resize(size_t newCount){
+        count = newCount;
+        size_t paddedCount = padded(newCount);
+        x.resize(paddedCount, 0.0f);
+        y.resize(paddedCount, 0.0f);
+        z.resize(paddedCount, 0.0f);
+        if(has(POINT_CHANNEL_COLOR)) color.resize(paddedCount, 0xFFFFFFFF);
+        if(has(POINT_CHANNEL_SCALE)) scale.resize(paddedCount, 1.0f);
+        if(has(POINT_CHANNEL_ID)) id.resize(paddedCount, 0);
+        if(has(POINT_CHANNEL_MESH)) mesh.resize(paddedCount, 0);
+    }
+
+    // append a point, the attribute channels keep their default values
+    void push(float px, float py, float pz){
+        size_t index = count;
+        if(index == x.size()){
+            resize(index + 1);
+        }else{
+            count++;
+        }
+        x[index] = px;
+        y[index] = py;
+        z[index] = pz;
+    }
+
+    void clear(){
+        resize(0);
+    }
+
+    // p = p * scale + offset for all points, a straight aligned loop per array
+    void scaleOffset(float factor, float offsetX, float offsetY, float offsetZ){
+        transform(x, factor, offsetX);
+        transform(y, factor, offsetY);
+        transform(z, factor, offsetZ);
+    }
+
+private:
+    uint32_t channels;
+    size_t count = 0;
+
+    static void transform(Floats &values, float factor, float offset){
+        float * data = static_cast<float *>(ASSUME_ALIGNED(values.data(), alignment));
+        const size_t n = values.size();
+        for(size_t i = 0; i < n; i++){
+            data[i] = data[i] * factor + offset;
+        }
+    }
+};
+
+#endif //PIPELINES_POINTFRAME_H
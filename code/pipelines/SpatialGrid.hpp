@@ -0,0 +1,440 @@
+//
+// Uniform grid over the streamed points, for spatial queries (culling, picking, proximity)
+//
+
+#ifndef PIPELINES_SPATIALGRID_H
+#define PIPELINES_SPATIALGRID_H
+
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "PointFrame.hpp"
+
+// Half space of a query volume, the points with a * x + b * y + c * z + d >= 0 are inside
+struct GridPlane{
+    float a, b, c, d;
+};
+
+// The points are binned into cubic cells by a counting sort: the points of cell c are pointIndex[cellStart[c] .. cellStart[c + 1]).
+// Queries only visit the cells overlapping the query volume, so they cost O(cells touched + result) instead of O(points).
+// Frames with the same number of points update incrementally: points are matched by their index, a point that moved into
+// another cell goes to an overflow list (its sorted entry turns stale), the grid is only rebuilt when the overflow list grows
+// too long, the point count changes or a point leaves the bounds of the grid.
+// Query results are indices of the points of the latest frame.
+class SpatialGrid{
+public:
+    // edge length of a cell in the units of the points, grows if the bounds would need more than maxCellsPerPoint cells per point
+    float cellSize = 50.0f;
+    float maxCellsPerPoint = 2.0f;
+    // empty border around the bounds, in cells, so points moving slightly outwards don't force a rebuild
+    float margin = 1.0f;
+    // rebuild once more than this share of the points is in the overflow list
+    float maxOverflow = 0.125f;
+
+    struct Stats{
+        uint32_t rebuilds = 0;
+        uint32_t updates = 0;
+        // duration of the last rebuild or update in milliseconds
+        double lastMs = 0.0;
+        bool lastWasRebuild = false;
+    };
+    Stats stats;
+
+    uint32_t size() const{
+        return count;
+    }
+
+    uint32_t cellCount() const{
+        return dim[0] * dim[1] * dim[2];
+    }
+
+    // edge length of the cells the grid actually uses
+    float usedCellSize() const{
+        return cell;
+    }
+
+    uint32_t overflowCount() const{
+        return static_cast<uint32_t>(overflow.size());
+    }
+
+    // position of a point of the latest frame
+    void position(uint32_t i, float &px, float &py, float &pz) const{
+        px = x[i];
+        py = y[i];
+        pz = z[i];
+    }
+
+    // Index the points of a new frame, incrementally if possible
+    void update(const PointFrame &points){
+        auto start = std::chrono::steady_clock::now();
+        bool rebuild = (points.size() != count) || cellStart.empty();
+        count = static_cast<uint32_t>(points.size());
+        x = points.x;
+        y = points.y;
+        z = points.z;
+
+        if(!rebuild){
+            float min[3], max[3];
+            bounds(min, max);
+            for(int k = 0; k < 3; k++){
+                rebuild = rebuild || min[k] < origin[k] || max[k] >= origin[k] + dim[k] * cell;
+            }
+        }
+        if(!rebuild){
+            binKeys();
+            for(uint32_t i = 0; i < count; i++){
+                if(keys[i] != sortedKeys[i] && !inOverflow[i]){
+                    inOverflow[i] = 1;
+                    overflow.push_back(i);
+                }
+            }
+            rebuild = overflow.size() > maxOverflow * count;
+        }
+
+        if(count == 0){
+            // nothing to index, the queries return early and the next frame with points rebuilds
+            clear();
+            stats.rebuilds++;
+        }else if(rebuild){
+            build();
+            stats.rebuilds++;
+        }else{
+            stats.updates++;
+        }
+        stats.lastWasRebuild = rebuild;
+        stats.lastMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Points within radius of a position
+    void queryRadius(float px, float py, float pz, float radius, std::vector<uint32_t> &result) const{
+        result.clear();
+        if(count == 0){
+            return;
+        }
+        const float center[3] = { px, py, pz };
+        uint32_t lo[3], hi[3];
+        for(int k = 0; k < 3; k++){
+            lo[k] = cellOf(center[k] - radius, k);
+            hi[k] = cellOf(center[k] + radius, k) + 1;
+        }
+        const float radius2 = radius * radius;
+        auto test = [&](uint32_t i){
+            float dx = x[i] - px, dy = y[i] - py, dz = z[i] - pz;
+            if(dx * dx + dy * dy + dz * dz <= radius2){
+                result.push_back(i);
+            }
+        };
+        forCells(lo, hi, test);
+        for(auto i : overflow){
+            test(i);
+        }
+    }
+
+    // Points inside all planes (e.g. the 6 planes of the view frustum)
+    // Blocks of cells fully inside are taken without testing their points, blocks crossing a plane are split down to single cells
+    void queryPlanes(const GridPlane *planes, uint32_t planeCount, std::vector<uint32_t> &result) const{
+        result.clear();
+        if(count == 0){
+            return;
+        }
+        uint32_t lo[3] = { 0, 0, 0 };
+        uint32_t hi[3] = { dim[0], dim[1], dim[2] };
+        queryBlock(planes, planeCount, lo, hi, result);
+        for(auto i : overflow){
+            if(inside(planes, planeCount, x[i], y[i], z[i])){
+                result.push_back(i);
+            }
+        }
+    }
+
+    // Closest point along a ray within radius of it, e.g. for picking
+    // The cells are walked front to back (3D DDA) and the walk stops once it's past the closest hit
+    // direction: normalized; distance: distance of the hit along the ray
+    bool queryRay(float ox, float oy, float oz, float dx, float dy, float dz, float radius, float maxDistance,
+                  uint32_t &hit, float &distance) const{
+        if(count == 0){
+            return false;
+        }
+        const float o[3] = { ox, oy, oz };
+        const float d[3] = { dx, dy, dz };
+        const float radius2 = radius * radius;
+        float best = maxDistance;
+        bool found = false;
+        auto test = [&](uint32_t i){
+            float vx = x[i] - ox, vy = y[i] - oy, vz = z[i] - oz;
+            float t = vx * dx + vy * dy + vz * dz;
+            if(t < 0.0f || t > best){
+                return;
+            }
+            if(vx * vx + vy * vy + vz * vz - t * t <= radius2){
+                best = t;
+                hit = i;
+                found = true;
+            }
+        };
+        for(auto i : overflow){
+            test(i);
+        }
+
+        // Part of the ray inside the grid (grown by the radius)
+        float tEnter = 0.0f;
+        float tExit = maxDistance;
+        for(int k = 0; k < 3; k++){
+            float lower = origin[k] - radius;
+            float upper = origin[k] + dim[k] * cell + radius;
+            if(d[k] == 0.0f){
+                if(o[k] < lower || o[k] > upper){
+                    return found;
+                }
+                continue;
+            }
+            float t0 = (lower - o[k]) / d[k];
+            float t1 = (upper - o[k]) / d[k];
+            tEnter = std::max(tEnter, std::min(t0, t1));
+            tExit = std::min(tExit, std::max(t0, t1));
+        }
+        if(tEnter > tExit){
+            return found;
+        }
+
+        // Points within radius of the ray at t are within ring cells of the cell the ray is in at t
+        const int ring = static_cast<int>(ceilf(radius / cell));
+        int c[3], step[3];
+        float tMax[3], tDelta[3];
+        for(int k = 0; k < 3; k++){
+            c[k] = static_cast<int>(cellOf(o[k] + d[k] * tEnter, k));
+            step[k] = (d[k] > 0.0f) ? 1 : -1;
+            if(d[k] == 0.0f){
+                tMax[k] = FLT_MAX;
+                tDelta[k] = FLT_MAX;
+            }else{
+                float boundary = origin[k] + (c[k] + (step[k] > 0 ? 1 : 0)) * cell;
+                tMax[k] = (boundary - o[k]) / d[k];
+                tDelta[k] = cell / fabsf(d[k]);
+            }
+        }
+        while(tEnter <= std::min(best, tExit)){
+            uint32_t lo[3], hi[3];
+            for(int k = 0; k < 3; k++){
+                lo[k] = static_cast<uint32_t>(std::max(c[k] - ring, 0));
+                hi[k] = static_cast<uint32_t>(std::min(c[k] + ring + 1, static_cast<int>(dim[k])));
+            }
+            forCells(lo, hi, test);
+
+            int axis = (tMax[0] < tMax[1]) ? (tMax[0] < tMax[2] ? 0 : 2) : (tMax[1] < tMax[2] ? 1 : 2);
+            tEnter = tMax[axis];
+            c[axis] += step[axis];
+            if(c[axis] < 0 || c[axis] >= static_cast<int>(dim[axis])){
+                break;
+            }
+            tMax[axis] += tDelta[axis];
+        }
+        distance = best;
+        return found;
+    }
+
+private:
+    uint32_t count = 0;
+    // copy of the positions of the latest frame (padded like PointFrame)
+    PointFrame::Floats x;
+    PointFrame::Floats y;
+    PointFrame::Floats z;
+
+    float origin[3] = { 0.0f, 0.0f, 0.0f };
+    uint32_t dim[3] = { 0, 0, 0 };
+    float cell = 1.0f;
+
+    // cell of each point in the latest frame and in the sorted arrays
+    PointFrame::Uints keys;
+    std::vector<uint32_t> sortedKeys;
+    std::vector<uint32_t> cellStart;
+    std::vector<uint32_t> pointIndex;
+    // points that left the cell they were sorted into
+    std::vector<uint32_t> overflow;
+    std::vector<uint8_t> inOverflow;
+
+    uint32_t cellOf(float value, int k) const{
+        float c = floorf((value - origin[k]) / cell);
+        return static_cast<uint32_t>(std::min(std::max(0.0f, c), static_cast<float>(dim[k] - 1)));
+    }
+
+    // min and max of the points, straight loops so they vectorize
+    void bounds(float min[3], float max[3]) const{
+        const PointFrame::Floats *axes[3] = { &x, &y, &z };
+        for(int k = 0; k < 3; k++){
+            const float * values = static_cast<const float *>(ASSUME_ALIGNED(axes[k]->data(), PointFrame::alignment));
+            float lo = FLT_MAX, hi = -FLT_MAX;
+            for(uint32_t i = 0; i < count; i++){
+                lo = std::min(lo, values[i]);
+                hi = std::max(hi, values[i]);
+            }
+            min[k] = lo;
+            max[k] = hi;
+        }
+    }
+
+    // Cell of every point (including the padding), branch free over the aligned arrays so the loop vectorizes
+    void binKeys(){
+        const size_t n = x.size();
+        keys.resize(n);
+        const float * px = static_cast<const float *>(ASSUME_ALIGNED(x.data(), PointFrame::alignment));
+        const float * py = static_cast<const float *>(ASSUME_ALIGNED(y.data(), PointFrame::alignment));
+        const float * pz = static_cast<const float *>(ASSUME_ALIGNED(z.data(), PointFrame::alignment));
+        uint32_t * k = static_cast<uint32_t *>(ASSUME_ALIGNED(keys.data(), PointFrame::alignment));
+        const float inv = 1.0f / cell;
+        const float ox = origin[0], oy = origin[1], oz = origin[2];
+        const float mx = static_cast<float>(dim[0] - 1), my = static_cast<float>(dim[1] - 1), mz = static_cast<float>(dim[2] - 1);
+        const uint32_t dx = dim[0], dy = dim[1];
+        for(size_t i = 0; i < n; i++){
+            // clamped before the conversion, the padding may hold any value (max(0, NaN) is 0)
+            uint32_t cx = static_cast<uint32_t>(std::min(std::max(0.0f, (px[i] - ox) * inv), mx));
+            uint32_t cy = static_cast<uint32_t>(std::min(std::max(0.0f, (py[i] - oy) * inv), my));
+            uint32_t cz = static_cast<uint32_t>(std::min(std::max(0.0f, (pz[i] - oz) * inv), mz));
+            k[i] = (cz * dy + cy) * dx + cx;
+        }
+    }
+
+    void clear(){
+        dim[0] = dim[1] = dim[2] = 0;
+        cellStart.clear();
+        pointIndex.clear();
+        sortedKeys.clear();
+        overflow.clear();
+        inOverflow.clear();
+    }
+
+    // Fit the grid to the points (at least one) and counting sort them into the cells
+    void build(){
+        float min[3], max[3];
+        bounds(min, max);
+        // the margin alone takes minDim cells per axis, however large the cells get
+        const uint32_t minDim = static_cast<uint32_t>(2.0f * std::max(margin, 0.0f)) + 1;
+        const double maxCells = std::max(static_cast<double>(minDim) * minDim * minDim, static_cast<double>(maxCellsPerPoint) * count);
+        // grow by the cube root of 2 per step, the limit is only reached by bounds that aren't finite
+        const int maxGrowthSteps = 128;
+        cell = std::max(cellSize, 1e-6f);
+        for(int step = 0; ; step++){
+            double cells = 1.0;
+            for(int k = 0; k < 3; k++){
+                double cellsOnAxis = (static_cast<double>(max[k]) - min[k]) / cell + 2.0 * margin;
+                // also catches NaN
+                if(!(cellsOnAxis < maxCells)){
+                    cellsOnAxis = maxCells;
+                }
+                dim[k] = static_cast<uint32_t>(cellsOnAxis) + 1;
+                cells *= dim[k];
+            }
+            if(cells <= maxCells){
+                break;
+            }
+            if(step == maxGrowthSteps){
+                dim[0] = dim[1] = dim[2] = minDim;
+                break;
+            }
+            cell *= 1.26f;
+        }
+        for(int k = 0; k < 3; k++){
+            origin[k] = min[k] - margin * cell;
+        }
+
+        binKeys();
+        const uint32_t cells = cellCount();
+        cellStart.assign(cells + 1, 0);
+        for(uint32_t i = 0; i < count; i++){
+            cellStart[keys[i] + 1]++;
+        }
+        for(uint32_t c = 0; c < cells; c++){
+            cellStart[c + 1] += cellStart[c];
+        }
+        pointIndex.resize(count);
+        std::vector<uint32_t> cursor(cellStart.begin(), cellStart.end() - 1);
+        for(uint32_t i = 0; i < count; i++){
+            pointIndex[cursor[keys[i]]++] = i;
+        }
+        sortedKeys.assign(keys.begin(), keys.begin() + count);
+        overflow.clear();
+        inOverflow.assign(count, 0);
+    }
+
+    // Valid points of a block of cells [lo, hi)
+    template<typename F>
+    void forCells(const uint32_t lo[3], const uint32_t hi[3], F &f) const{
+        for(uint32_t cz = lo[2]; cz < hi[2]; cz++){
+            for(uint32_t cy = lo[1]; cy < hi[1]; cy++){
+                uint32_t row = (cz * dim[1] + cy) * dim[0];
+                for(uint32_t j = cellStart[row + lo[0]]; j < cellStart[row + hi[0]]; j++){
+                    uint32_t i = pointIndex[j];
+                    // stale entries of points in the overflow list are skipped
+                    if(!inOverflow[i]){
+                        f(i);
+                    }
+                }
+            }
+        }
+    }
+
+    static bool inside(const GridPlane *planes, uint32_t planeCount, float px, float py, float pz){
+        for(uint32_t p = 0; p < planeCount; p++){
+            if(planes[p].a * px + planes[p].b * py + planes[p].c * pz + planes[p].d < 0.0f){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void queryBlock(const GridPlane *planes, uint32_t planeCount, uint32_t lo[3], uint32_t hi[3], std::vector<uint32_t> &result) const{
+        float min[3], max[3];
+        for(int k = 0; k < 3; k++){
+            min[k] = origin[k] + lo[k] * cell;
+            max[k] = origin[k] + hi[k] * cell;
+        }
+        bool crossing = false;
+        for(uint32_t p = 0; p < planeCount; p++){
+            const GridPlane &plane = planes[p];
+            // corners of the block farthest inside and farthest outside of the plane
+            float inner = plane.d, outer = plane.d;
+            const float normal[3] = { plane.a, plane.b, plane.c };
+            for(int k = 0; k < 3; k++){
+                inner += normal[k] * (normal[k] >= 0.0f ? max[k] : min[k]);
+                outer += normal[k] * (normal[k] >= 0.0f ? min[k] : max[k]);
+            }
+            if(inner < 0.0f){
+                return;
+            }
+            crossing = crossing || (outer < 0.0f);
+        }
+        if(!crossing){
+            auto take = [&](uint32_t i){ result.push_back(i); };
+            forCells(lo, hi, take);
+            return;
+        }
+        int axis = 0;
+        for(int k = 1; k < 3; k++){
+            if(hi[k] - lo[k] > hi[axis] - lo[axis]){
+                axis = k;
+            }
+        }
+        if(hi[axis] - lo[axis] == 1){
+            // single cell crossing a plane, test its points
+            auto test = [&](uint32_t i){
+                if(inside(planes, planeCount, x[i], y[i], z[i])){
+                    result.push_back(i);
+                }
+            };
+            forCells(lo, hi, test);
+            return;
+        }
+        uint32_t split = (lo[axis] + hi[axis]) / 2;
+        uint32_t first[3] = { hi[0], hi[1], hi[2] };
+        first[axis] = split;
+        queryBlock(planes, planeCount, lo, first, result);
+        uint32_t second[3] = { lo[0], lo[1], lo[2] };
+        second[axis] = split;
+        queryBlock(planes, planeCount, second, hi, result);
+    }
+};
+
+#endif //PIPELINES_SPATIALGRID_H
@@ -2,7 +2,9 @@
 // Created by root on 1/8/17.
 //
 
+#if defined(__ANDROID__)
 #include <android/log.h>
+#endif
 #include <sys/time.h>
 #include <sstream>
 #include <fstream>
@@ -7,6 +7,25 @@
 
 #include <string>
 
+#if defined(__ANDROID__)
+#include <android/log.h>
+#else
+// Host builds (headless benchmarking) print the Android log messages to the console
+#include <cstdio>
+#include <cstdarg>
+enum { ANDROID_LOG_INFO = 4, ANDROID_LOG_WARN = 5, ANDROID_LOG_DEBUG = 3, ANDROID_LOG_ERROR = 6 };
+inline int __android_log_print(int prio, const char *tag, const char *fmt, ...){
+    FILE * stream = (prio >= ANDROID_LOG_WARN) ? stderr : stdout;
+    fprintf(stream, "%s: ", tag);
+    va_list args;
+    va_start(args, fmt);
+    int result = vfprintf(stream, fmt, args);
+    va_end(args);
+    fprintf(stream, "\n");
+    return result;
+}
+#endif
+
 #define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
 
 #define BeginTrace(func_name) \
@@ -3,9 +3,11 @@
 #define PIPELINES_MODELS_H
 
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <fstream>
 #include <vector>
+#include <chrono>
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -15,12 +17,20 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/packing.hpp>
 
+#include "vulkan/vulkan.h"
+
+#if defined(__ANDROID__)
 #include <android/asset_manager.h>
 #include <VulkanAndroid.h>
+#endif
 #include "Datagram.hpp"
 #include "DataStream.hpp"
 #include "TraceTime.hpp"
+#include "MeshOptimizer.hpp"
+#include "InstanceStore.hpp"
+#include "SpatialGrid.hpp"
 
 
 namespace vks
@@ -34,9 +44,27 @@ namespace vks
         VERTEX_COMPONENT_TANGENT = 0x4,
         VERTEX_COMPONENT_BITANGENT = 0x5,
         VERTEX_COMPONENT_DUMMY_FLOAT = 0x6,
-        VERTEX_COMPONENT_DUMMY_VEC4 = 0x7
+        VERTEX_COMPONENT_DUMMY_VEC4 = 0x7,
+        // Packed encodings, imported like their float counterparts and converted when the vertices are written to the GPU
+        /** @brief 16 bit snorm xyz (+ padding) relative to the bounds box of the vertices, decoded as bounds center + value * bounds extent */
+        VERTEX_COMPONENT_POSITION_SNORM16 = 0x8,
+        /** @brief Half float xyz (+ padding) */
+        VERTEX_COMPONENT_POSITION_HALF = 0x9,
+        /** @brief Octahedral encoded unit normal, 2 x 16 bit snorm */
+        VERTEX_COMPONENT_NORMAL_OCT16 = 0xA,
+        /** @brief 8 bit unorm rgba (alpha is 1) */
+        VERTEX_COMPONENT_COLOR_RGBA8 = 0xB,
+        /** @brief Half float uv */
+        VERTEX_COMPONENT_UV_HALF = 0xC
     } Component;
 
+    /** @brief Bounds box the positions of a VERTEX_COMPONENT_POSITION_SNORM16 component are quantized to */
+    struct VertexBounds {
+        glm::vec3 center = glm::vec3(0.0f);
+        /** @brief Half the size of the box, never zero */
+        glm::vec3 extent = glm::vec3(1.0f);
+    };
+
     /** @brief Stores vertex layout components for model loading and Vulkan vertex input and atribute bindings  */
     struct VertexLayout {
     public:
@@ -48,28 +76,258 @@ namespace vks
             this->components = std::move(components);
         }
 
+        /** @brief Number of floats a component takes up in the imported (unpacked) vertex data */
+        static uint32_t componentFloats(Component component)
+        {
+            switch (component)
+            {
+                case VERTEX_COMPONENT_UV:
+                case VERTEX_COMPONENT_UV_HALF:
+                    return 2;
+                case VERTEX_COMPONENT_DUMMY_FLOAT:
+                    return 1;
+                case VERTEX_COMPONENT_DUMMY_VEC4:
+                    return 4;
+                default:
+                    // All components except the ones listed above are made up of 3 floats
+                    return 3;
+            }
+        }
+
+        /** @brief Format of a component in the vertex buffer */
+        static VkFormat componentFormat(Component component)
+        {
+            switch (component)
+            {
+                case VERTEX_COMPONENT_UV:
+                    return VK_FORMAT_R32G32_SFLOAT;
+                case VERTEX_COMPONENT_DUMMY_FLOAT:
+                    return VK_FORMAT_R32_SFLOAT;
+                case VERTEX_COMPONENT_DUMMY_VEC4:
+                    return VK_FORMAT_R32G32B32A32_SFLOAT;
+                case VERTEX_COMPONENT_POSITION_SNORM16:
+                    return VK_FORMAT_R16G16B16A16_SNORM;
+                case VERTEX_COMPONENT_POSITION_HALF:
+                    return VK_FORMAT_R16G16B16A16_SFLOAT;
+                case VERTEX_COMPONENT_NORMAL_OCT16:
+                    return VK_FORMAT_R16G16_SNORM;
+                case VERTEX_COMPONENT_COLOR_RGBA8:
+                    return VK_FORMAT_R8G8B8A8_UNORM;
+                case VERTEX_COMPONENT_UV_HALF:
+                    return VK_FORMAT_R16G16_SFLOAT;
+                default:
+                    return VK_FORMAT_R32G32B32_SFLOAT;
+            }
+        }
+
+        /** @brief Size of a component in the vertex buffer in bytes */
+        static uint32_t componentSize(Component component)
+        {
+            switch (component)
+            {
+                case VERTEX_COMPONENT_POSITION_SNORM16:
+                case VERTEX_COMPONENT_POSITION_HALF:
+                    return 4 * sizeof(uint16_t);
+                case VERTEX_COMPONENT_NORMAL_OCT16:
+                case VERTEX_COMPONENT_UV_HALF:
+                    return 2 * sizeof(uint16_t);
+                case VERTEX_COMPONENT_COLOR_RGBA8:
+                    return 4 * sizeof(uint8_t);
+                default:
+                    return componentFloats(component) * sizeof(float);
+            }
+        }
+
+        /** @brief Size of a vertex in the vertex buffer in bytes */
         uint32_t stride()
         {
             uint32_t res = 0;
             for (auto& component : components)
             {
-                switch (component)
+                res += componentSize(component);
+            }
+            return res;
+        }
+
+        /** @brief Number of floats per vertex in the imported (unpacked) vertex data */
+        uint32_t floatStride()
+        {
+            uint32_t res = 0;
+            for (auto& component : components)
+            {
+                res += componentFloats(component);
+            }
+            return res;
+        }
+
+        /** @brief Float offset of the position in the imported (unpacked) vertex data, -1 if the layout has no position */
+        int32_t positionOffset()
+        {
+            int32_t offset = 0;
+            for (auto& component : components)
+            {
+                if (component == VERTEX_COMPONENT_POSITION || component == VERTEX_COMPONENT_POSITION_SNORM16 || component == VERTEX_COMPONENT_POSITION_HALF)
                 {
-                    case VERTEX_COMPONENT_UV:
-                        res += 2 * sizeof(float);
-                        break;
-                    case VERTEX_COMPONENT_DUMMY_FLOAT:
-                        res += sizeof(float);
-                        break;
-                    case VERTEX_COMPONENT_DUMMY_VEC4:
-                        res += 4 * sizeof(float);
-                        break;
-                    default:
-                        // All components except the ones listed above are made up of 3 floats
-                        res += 3 * sizeof(float);
+                    return offset;
+                }
+                offset += componentFloats(component);
+            }
+            return -1;
+        }
+
+        /** @brief True if the vertex buffer layout differs from the imported float data */
+        bool packed()
+        {
+            for (auto& component : components)
+            {
+                if (componentSize(component) != componentFloats(component) * sizeof(float))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+        * Generate the vertex attributes of the layout, one location per component (dummy components only add padding)
+        *
+        * @param binding Vertex buffer binding the attributes are read from
+        * @param firstLocation Shader location of the first component
+        */
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions(uint32_t binding, uint32_t firstLocation = 0)
+        {
+            std::vector<VkVertexInputAttributeDescription> attributes;
+            uint32_t offset = 0;
+            uint32_t location = firstLocation;
+            for (auto& component : components)
+            {
+                if (component != VERTEX_COMPONENT_DUMMY_FLOAT && component != VERTEX_COMPONENT_DUMMY_VEC4)
+                {
+                    VkVertexInputAttributeDescription attribute = {};
+                    attribute.location = location++;
+                    attribute.binding = binding;
+                    attribute.format = componentFormat(component);
+                    attribute.offset = offset;
+                    attributes.push_back(attribute);
+                }
+                offset += componentSize(component);
+            }
+            return attributes;
+        }
+
+        /**
+        * Bounds box of the positions in imported (unpacked) vertex data, used to quantize VERTEX_COMPONENT_POSITION_SNORM16
+        *
+        * @return Identity box (decoding leaves the positions unchanged) if the layout has no quantized positions
+        */
+        VertexBounds bounds(const float *vertices, uint32_t vertexCount)
+        {
+            VertexBounds result;
+            uint32_t positionOffset = 0;
+            bool found = false;
+            for (auto& component : components)
+            {
+                if (component == VERTEX_COMPONENT_POSITION_SNORM16)
+                {
+                    found = true;
+                    break;
+                }
+                positionOffset += componentFloats(component);
+            }
+            if (!found || vertexCount == 0)
+            {
+                return result;
+            }
+            uint32_t floats = floatStride();
+            glm::vec3 min(FLT_MAX);
+            glm::vec3 max(-FLT_MAX);
+            for (uint32_t i = 0; i < vertexCount; i++)
+            {
+                const float *position = vertices + i * floats + positionOffset;
+                glm::vec3 p(position[0], position[1], position[2]);
+                min = glm::min(min, p);
+                max = glm::max(max, p);
+            }
+            result.center = (min + max) * 0.5f;
+            // Keep a minimal extent so flat boxes don't divide by zero
+            result.extent = glm::max((max - min) * 0.5f, glm::vec3(1e-6f));
+            return result;
+        }
+
+        /** @brief Octahedral mapping of a unit vector to [-1, 1]^2 */
+        static glm::vec2 octEncode(glm::vec3 n)
+        {
+            n /= (fabs(n.x) + fabs(n.y) + fabs(n.z));
+            glm::vec2 e(n.x, n.y);
+            if (n.z < 0.0f)
+            {
+                e.x = (1.0f - fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+                e.y = (1.0f - fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+            }
+            return e;
+        }
+
+        /**
+        * Convert imported (unpacked) vertex data to the vertex buffer layout
+        *
+        * @param vertices Imported vertex data, floatStride floats per vertex
+        * @param vertexCount Number of vertices to convert
+        * @param dst Destination with room for vertexCount * stride bytes (e.g. a mapped buffer)
+        * @param bounds Bounds box of the positions (see bounds), only used by VERTEX_COMPONENT_POSITION_SNORM16
+        */
+        void pack(const float *vertices, uint32_t vertexCount, void *dst, const VertexBounds &bounds = VertexBounds())
+        {
+            if (!packed())
+            {
+                memcpy(dst, vertices, vertexCount * stride());
+                return;
+            }
+            const glm::vec3 invExtent = 1.0f / bounds.extent;
+            uint8_t *out = static_cast<uint8_t*>(dst);
+            const float *in = vertices;
+            for (uint32_t i = 0; i < vertexCount; i++)
+            {
+                for (auto& component : components)
+                {
+                    switch (component)
+                    {
+                        case VERTEX_COMPONENT_POSITION_SNORM16: {
+                            glm::vec3 p = (glm::vec3(in[0], in[1], in[2]) - bounds.center) * invExtent;
+                            uint16_t v[4] = { glm::packSnorm1x16(p.x), glm::packSnorm1x16(p.y), glm::packSnorm1x16(p.z), 0 };
+                            memcpy(out, v, sizeof(v));
+                            break;
+                        }
+                        case VERTEX_COMPONENT_POSITION_HALF: {
+                            uint16_t v[4] = { glm::packHalf1x16(in[0]), glm::packHalf1x16(in[1]), glm::packHalf1x16(in[2]), 0 };
+                            memcpy(out, v, sizeof(v));
+                            break;
+                        }
+                        case VERTEX_COMPONENT_NORMAL_OCT16: {
+                            glm::vec3 n(in[0], in[1], in[2]);
+                            glm::vec2 e = (glm::dot(n, n) > 0.0f) ? octEncode(n) : glm::vec2(0.0f);
+                            uint16_t v[2] = { glm::packSnorm1x16(e.x), glm::packSnorm1x16(e.y) };
+                            memcpy(out, v, sizeof(v));
+                            break;
+                        }
+                        case VERTEX_COMPONENT_COLOR_RGBA8: {
+                            out[0] = glm::packUnorm1x8(in[0]);
+                            out[1] = glm::packUnorm1x8(in[1]);
+                            out[2] = glm::packUnorm1x8(in[2]);
+                            out[3] = 255;
+                            break;
+                        }
+                        case VERTEX_COMPONENT_UV_HALF: {
+                            uint16_t v[2] = { glm::packHalf1x16(in[0]), glm::packHalf1x16(in[1]) };
+                            memcpy(out, v, sizeof(v));
+                            break;
+                        }
+                        default:
+                            memcpy(out, in, componentSize(component));
+                    }
+                    in += componentFloats(component);
+                    out += componentSize(component);
                 }
             }
-            return res;
         }
     };
 
@@ -110,18 +368,70 @@ namespace vks
         };
         std::vector<ModelPart> parts;
 
-        // vertices and indices which are loaded from the file
+        // vertices and indices which are loaded from the files, shared by all mesh types (the arena)
         std::vector<float> vertexBuffer;
         std::vector<uint32_t> indexBuffer;
 
-        // vertices and indices for rendering
-        // The data may vary according to the data from the server
-        std::vector<float> renderingVertices;
-        std::vector<uint32_t> renderingIndices;
-        uint32_t renderingVerticesCount = 0;
-        uint32_t renderingIndicesCount = 0;
+        // Level of detail of a mesh type, a range of the index buffer
+        struct MeshLod {
+            uint32_t firstIndex;
+            uint32_t indexCount;
+        };
+
+        // Mesh registry: every imported file is a mesh type, the mesh channel of the points selects it (index of meshTypes)
+        // The indices of a type are relative to its first vertex, draws pass vertexBase as their vertex offset
+        struct MeshType {
+            std::string name;
+            uint32_t vertexBase = 0;
+            uint32_t vertexCount = 0;
+            // the imported mesh followed by simplified versions (all share the type's vertices)
+            std::vector<MeshLod> lods;
+            // diffuse color of the first part's material, for renderers that don't draw the mesh itself (e.g. impostors)
+            glm::vec3 materialColor = glm::vec3(1.0f);
+            // bounding sphere of the type's vertices
+            glm::vec3 center = glm::vec3(0.0f);
+            float radius = 0.0f;
+        };
+        std::vector<MeshType> meshTypes;
+        // Levels of detail of every type: the mesh levels of the type with the most, then the impostor level
+        // (types with fewer mesh levels leave the levels in between empty)
+        // The instances are kept in buckets per type and level: bucket = type * levelCount + level
+        uint32_t levelCount = 1;
+        // Grid resolution of the vertex clustering for each simplified level, a level that doesn't remove at least a
+        // quarter of the previous level's triangles is left out
+        std::vector<uint32_t> lodGridSizes = { 16, 8 };
+        // Projected size (pixels) below which an instance leaves mesh level i for the next one, the last mesh level is
+        // kept down to impostorSize
+        std::vector<float> lodSizes = { 96.0f, 32.0f };
+        float impostorSize = 12.0f;
+        // Relative margin around the thresholds, so instances near a threshold don't switch back and forth
+        float lodHysteresis = 0.1f;
+
+        // Instances of the mesh, one per point of the latest frame from the server
+        // Each instance holds the position of the point in the previous and the current frame, the vertex shader
+        // interpolates between them so the motion runs at the display rate instead of the network rate
+        static const uint32_t instanceFloats = InstanceStore::instanceFloats;
+        InstanceStore instances;
+        // Number of the frames taken from the server
+        uint32_t frameNumber = 0;
+        // Render mode requested by the stream of the latest frame
+        StreamRenderMode renderMode = STREAM_RENDER_AUTO;
+        // A point that moved less than this (on every axis) since the last frame counts as unchanged, so it isn't uploaded again
+        // Keeps sensor noise from dirtying every instance, in the units of the stream's positions
+        float moveThreshold = 0.01f;
+        // Arrival of the frames the previous and current positions are from
+        std::chrono::steady_clock::time_point previousArrival;
+        std::chrono::steady_clock::time_point currentArrival;
         bool isDataChanged = true;
-        int prePosSize = 0;
+        // Uniform grid over the points of the latest frame, for culling, picking and proximity queries on the stream
+        SpatialGrid spatialIndex;
+
+        // Bucket changes of the last selectLods (kept to avoid allocations per frame)
+        struct BucketChange {
+            InstanceHandle handle;
+            uint32_t bucket;
+        };
+        std::vector<BucketChange> bucketChanges;
 
         static const int defaultFlags = aiProcess_FlipWindingOrder | aiProcess_Triangulate | aiProcess_PreTransformVertices | aiProcess_CalcTangentSpace | aiProcess_GenSmoothNormals;
 
@@ -154,6 +464,7 @@ namespace vks
             const aiScene* pScene;
 
             // Load file
+#if defined(__ANDROID__)
             // Meshes are stored inside the apk on Android (compressed)
             // So they need to be loaded via the asset manager
 
@@ -174,12 +485,21 @@ namespace vks
             pScene = Importer.ReadFileFromMemory(meshData, size, flags);
 
             free(meshData);
+#else
+            pScene = Importer.ReadFile(filename.c_str(), flags);
+#endif
 
             if (pScene)
             {
 				parts.clear();
 				parts.resize(pScene->mNumMeshes);
 
+                // The file is appended to the arena as a new mesh type
+                MeshType type;
+                type.name = filename;
+                type.vertexBase = vertexCount;
+                const uint32_t firstIndex = static_cast<uint32_t>(indexBuffer.size());
+
                 glm::vec3 scale(1.0f);
                 glm::vec2 uvscale(1.0f);
                 glm::vec3 center(0.0f);
@@ -190,11 +510,6 @@ namespace vks
                     center = createInfo->center;
                 }
 
-                vertexCount = 0;
-                indexCount = 0;
-                vertexBuffer.clear();
-                indexBuffer.clear();
-
                 // Load meshes
 				for (unsigned int i = 0; i < pScene->mNumMeshes; i++)
                 {
@@ -207,6 +522,10 @@ namespace vks
 
                     aiColor3D pColor(0.f, 0.f, 0.f);
                     pScene->mMaterials[paiMesh->mMaterialIndex]->Get(AI_MATKEY_COLOR_DIFFUSE, pColor);
+                    if (i == 0)
+                    {
+                        type.materialColor = glm::vec3(pColor.r, pColor.g, pColor.b);
+                    }
 
                     const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
 
@@ -222,20 +541,25 @@ namespace vks
                         {
                             switch (component) {
                                 case VERTEX_COMPONENT_POSITION:
+                                case VERTEX_COMPONENT_POSITION_SNORM16:
+                                case VERTEX_COMPONENT_POSITION_HALF:
 								    vertexBuffer.push_back(pPos->x * scale.x + center.x);
 								    vertexBuffer.push_back(-pPos->y * scale.y + center.y);
 								    vertexBuffer.push_back(pPos->z * scale.z + center.z);
                                     break;
                                 case VERTEX_COMPONENT_NORMAL:
+                                case VERTEX_COMPONENT_NORMAL_OCT16:
                                     vertexBuffer.push_back(pNormal->x);
                                     vertexBuffer.push_back(-pNormal->y);
                                     vertexBuffer.push_back(pNormal->z);
                                     break;
                                 case VERTEX_COMPONENT_UV:
+                                case VERTEX_COMPONENT_UV_HALF:
                                     vertexBuffer.push_back(pTexCoord->x * uvscale.s);
                                     vertexBuffer.push_back(pTexCoord->y * uvscale.t);
                                     break;
                                 case VERTEX_COMPONENT_COLOR:
+                                case VERTEX_COMPONENT_COLOR_RGBA8:
                                     vertexBuffer.push_back(pColor.r);
                                     vertexBuffer.push_back(pColor.g);
                                     vertexBuffer.push_back(pColor.b);
@@ -274,22 +598,48 @@ namespace vks
 
                     dim.size = dim.max - dim.min;
 
-                    parts[i].vertexCount = paiMesh->mNumVertices;
-
-                    uint32_t indexBase = static_cast<uint32_t>(indexBuffer.size());
+                    // Face indices are relative to the mesh
+                    std::vector<uint32_t> meshIndices;
+                    meshIndices.reserve(paiMesh->mNumFaces * 3);
                     for (unsigned int j = 0; j < paiMesh->mNumFaces; j++)
                     {
                         const aiFace& Face = paiMesh->mFaces[j];
                         if (Face.mNumIndices != 3)
                             continue;
-                        indexBuffer.push_back(indexBase + Face.mIndices[0]);
-                        indexBuffer.push_back(indexBase + Face.mIndices[1]);
-                        indexBuffer.push_back(indexBase + Face.mIndices[2]);
-                        parts[i].indexCount += 3;
-                        indexCount += 3;
+                        meshIndices.push_back(Face.mIndices[0]);
+                        meshIndices.push_back(Face.mIndices[1]);
+                        meshIndices.push_back(Face.mIndices[2]);
+                    }
+
+                    // Weld the vertices that became identical with this layout, then reorder for the vertex cache and fetch
+                    uint32_t floatStride = layout.floatStride();
+                    std::vector<float> meshVertices(vertexBuffer.begin() + parts[i].vertexBase * floatStride, vertexBuffer.end());
+                    vertexBuffer.resize(parts[i].vertexBase * floatStride);
+                    meshopt::Statistics statistics = meshopt::optimize(meshVertices, floatStride, meshIndices);
+                    LOGD("Mesh %u of '%s': %u -> %u vertices, ACMR %.2f -> %.2f", i, filename.c_str(),
+                         statistics.verticesBefore, statistics.verticesAfter, statistics.acmrBefore, statistics.acmrAfter);
+
+                    vertexBuffer.insert(vertexBuffer.end(), meshVertices.begin(), meshVertices.end());
+                    for (auto index : meshIndices)
+                    {
+                        indexBuffer.push_back(parts[i].vertexBase - type.vertexBase + index);
                     }
+                    parts[i].vertexCount = statistics.verticesAfter;
+                    parts[i].indexCount = static_cast<uint32_t>(meshIndices.size());
+                    vertexCount = parts[i].vertexBase + parts[i].vertexCount;
+                    indexCount += parts[i].indexCount;
                 }
 
+                type.vertexCount = vertexCount - type.vertexBase;
+                MeshLod full = { firstIndex, static_cast<uint32_t>(indexBuffer.size()) - firstIndex };
+                type.lods.push_back(full);
+                buildLods(layout, type);
+                indexCount = static_cast<uint32_t>(indexBuffer.size());
+                meshTypes.push_back(type);
+
+                levelCount = std::max(levelCount, static_cast<uint32_t>(type.lods.size()) + 1);
+                // Instances can only exist after all types have been imported
+                instances.setBucketCount(static_cast<uint32_t>(meshTypes.size()) * levelCount);
                 return true;
             }
             else
@@ -315,6 +665,121 @@ namespace vks
             return loadFromFile(filename, layout, &modelCreateInfo, flags);
         }
 
+        // Append the simplified levels of a mesh type to the index buffer (see lodGridSizes) and compute its bounding sphere
+        void buildLods(VertexLayout &layout, MeshType &type)
+        {
+            const uint32_t floatStride = layout.floatStride();
+            int32_t positionOffset = layout.positionOffset();
+            if (positionOffset >= 0 && type.vertexCount > 0) {
+                std::vector<float> typeVertices(vertexBuffer.begin() + type.vertexBase * floatStride,
+                                                vertexBuffer.begin() + (type.vertexBase + type.vertexCount) * floatStride);
+
+                glm::vec3 min(FLT_MAX);
+                glm::vec3 max(-FLT_MAX);
+                for (uint32_t v = 0; v < type.vertexCount; v++) {
+                    const float *position = typeVertices.data() + v * floatStride + positionOffset;
+                    min = glm::min(min, glm::vec3(position[0], position[1], position[2]));
+                    max = glm::max(max, glm::vec3(position[0], position[1], position[2]));
+                }
+                type.center = (min + max) * 0.5f;
+                type.radius = glm::length(max - min) * 0.5f;
+
+                std::vector<uint32_t> fullIndices(indexBuffer.begin() + type.lods[0].firstIndex, indexBuffer.end());
+                for (auto gridSize : lodGridSizes) {
+                    std::vector<uint32_t> lodIndices = meshopt::simplifyClusters(typeVertices, floatStride, positionOffset, fullIndices, gridSize);
+                    if (lodIndices.empty() || lodIndices.size() * 4 > type.lods.back().indexCount * 3) {
+                        continue;
+                    }
+                    meshopt::optimizeVertexCache(lodIndices, type.vertexCount);
+                    MeshLod lod = { static_cast<uint32_t>(indexBuffer.size()), static_cast<uint32_t>(lodIndices.size()) };
+                    type.lods.push_back(lod);
+                    indexBuffer.insert(indexBuffer.end(), lodIndices.begin(), lodIndices.end());
+                }
+            }
+            for (size_t i = 0; i < type.lods.size(); i++) {
+                LOGD("LOD %zu of '%s': %u triangles", i, type.name.c_str(), type.lods[i].indexCount / 3);
+            }
+        }
+
+        uint32_t bucketCount() const {
+            return static_cast<uint32_t>(meshTypes.size()) * levelCount;
+        }
+
+        uint32_t bucketOf(uint32_t type, uint32_t level) const {
+            return type * levelCount + level;
+        }
+
+        uint32_t typeOfBucket(uint32_t bucket) const {
+            return bucket / levelCount;
+        }
+
+        uint32_t levelOfBucket(uint32_t bucket) const {
+            return bucket % levelCount;
+        }
+
+        // true if the bucket's instances are drawn as meshes, false if they are drawn as impostors (or the level is unused)
+        bool isMeshBucket(uint32_t bucket) const {
+            return levelOfBucket(bucket) < meshTypes[typeOfBucket(bucket)].lods.size();
+        }
+
+        // mesh type of a point, unknown types fall back to the first one
+        uint32_t typeOfPoint(const PointFrame &points, uint32_t n) const {
+            if (!points.has(POINT_CHANNEL_MESH) || points.mesh[n] >= meshTypes.size()) {
+                return 0;
+            }
+            return points.mesh[n];
+        }
+
+        // Level of detail of a type for a projected size
+        uint32_t levelForSize(const MeshType &type, float size, bool impostors) const {
+            const uint32_t meshLevels = static_cast<uint32_t>(type.lods.size());
+            uint32_t lod = 0;
+            while (lod + 1 < meshLevels && lod < lodSizes.size() && size < lodSizes[lod]) {
+                lod++;
+            }
+            if (impostors && size < impostorSize) {
+                lod = levelCount - 1;
+            }
+            return lod;
+        }
+
+        /**
+        * Select the level of detail of every instance by its projected size
+        *
+        * Instances switch only when their size passes a threshold by more than lodHysteresis, the instances that
+        * change their level (and the ones they are swapped with) are marked dirty
+        *
+        * @param modelView Transformation of the instance positions into view space (looking down -z)
+        * @param pixelScale Projected size (pixels) of a length of 1 at a view distance of 1, e.g. projection[1][1] * viewport height / 2
+        * @param impostors Allow the impostor level, otherwise the instances stay on the mesh levels
+        * @return Number of instances that changed their level
+        */
+        uint32_t selectLods(const glm::mat4 &modelView, float pixelScale, bool impostors) {
+            bucketChanges.clear();
+            const glm::vec4 depthRow(modelView[0][2], modelView[1][2], modelView[2][2], modelView[3][2]);
+            for (uint32_t i = 0; i < instances.size(); i++) {
+                const uint32_t bucket = instances.bucket[i];
+                const MeshType &type = meshTypes[typeOfBucket(bucket)];
+                const float *instance = instances.instance(i);
+                float depth = -glm::dot(depthRow, glm::vec4(instance[3], instance[4], instance[5], 1.0f));
+                // Instances behind the camera aren't visible, the cheapest level will do
+                float size = (depth > 0.0f) ? 2.0f * type.radius * pixelScale / depth : 0.0f;
+                uint32_t current = levelOfBucket(bucket);
+                uint32_t farther = levelForSize(type, size * (1.0f + lodHysteresis), impostors);
+                uint32_t closer = levelForSize(type, size * (1.0f - lodHysteresis), impostors);
+                uint32_t lod = (current < farther) ? farther : (current > closer) ? closer : current;
+                if (lod != current) {
+                    BucketChange change = { instances.handle(i), bucketOf(typeOfBucket(bucket), lod) };
+                    bucketChanges.push_back(change);
+                }
+            }
+            // Changing a bucket moves instances, so they are applied by handle after the pass
+            for (auto &change : bucketChanges) {
+                instances.setBucket(instances.index(change.handle), change.bucket);
+            }
+            return static_cast<uint32_t>(bucketChanges.size());
+        }
+
         // For measuring the time
         long renderingStartTime = -1;
         void loadFromServer(){
@@ -322,15 +787,13 @@ namespace vks
             Frame *frame = frames.getFrame();
             if (frame != nullptr) {
                 // Treat the positions as the center of the objects
-                std::vector<float> &positions = frame->points;
-                int size = positions.size();
-                if (size > 0 && size % 3 == 0) {
+                PointFrame &points = frame->points;
+                if (points.size() > 0) {
                     // For measuring the time
                     renderingStartTime = getCurrentTimeMillis();
-//                    long startTime = getCurrentTimeMillis();
-                    duplicateObjects(positions);
-//                    long duration = getCurrentTimeMillis() - startTime;
-//                    LOGD("Time consuming of duplicating cubes: %d", duration);
+                    updateInstances(points, frame->arrival);
+                    spatialIndex.update(points);
+                    renderMode = frame->renderMode;
                     isDataChanged = true;
                 } else {
                     // error, position data is not correct
@@ -340,69 +803,77 @@ namespace vks
             }
         }
 
-        void duplicateOneObject(glm::vec3 center){
-            int size = vertexBuffer.size();
-            int stride = size / vertexCount;
-            int currentSize = renderingVertices.size();
-            renderingVertices.insert(renderingVertices.end(), vertexBuffer.begin(), vertexBuffer.end());
-            for(int i = 0; i < size; i += stride){
-                renderingVertices[currentSize+i] = renderingVertices[currentSize+i] + center.x;
-                renderingVertices[currentSize+i + 1] = renderingVertices[currentSize+i + 1] + center.y;
-                renderingVertices[currentSize+i + 2] = renderingVertices[currentSize+i + 2] + center.z;
-                renderingVertices[currentSize+i + 8] = center.x;
-                renderingVertices[currentSize+i + 9] = center.y;
-                renderingVertices[currentSize+i + 10] = center.z;
+        // Move the current positions to the previous ones and take the new frame's positions as the current ones
+        // Points are matched by the id channel of the frame, or by their index if it has none. Points without an instance
+        // get one (starting at rest), instances whose point isn't part of the frame anymore are removed. The mesh channel
+        // moves the instances into the buckets of their mesh type.
+        // Only instances that were added, moved (by more than moveThreshold) or took the place of a removed one are marked dirty.
+        void updateInstances(const PointFrame &points, std::chrono::steady_clock::time_point arrival) {
+            frameNumber++;
+            const uint32_t pointCount = static_cast<uint32_t>(points.size());
+            const bool ids = points.has(POINT_CHANNEL_ID);
+            for (uint32_t n = 0; n < pointCount; n++) {
+                uint32_t pointId = ids ? points.id[n] : n;
+                InstanceHandle handle = instances.find(pointId);
+                uint32_t index;
+                const uint32_t type = typeOfPoint(points, n);
+                if (!instances.valid(handle)) {
+                    // New instances start as impostors of their type, selectLods picks their level
+                    handle = instances.add(pointId, points.x[n], points.y[n], points.z[n]);
+                    index = instances.setBucket(instances.index(handle), bucketOf(type, levelCount - 1));
+                } else {
+                    index = instances.index(handle);
+                    if (typeOfBucket(instances.bucket[index]) != type) {
+                        index = instances.setBucket(index, bucketOf(type, levelOfBucket(instances.bucket[index])));
+                    }
+                    float *instance = instances.instance(index);
+                    bool moving = instance[0] != instance[3] || instance[1] != instance[4] || instance[2] != instance[5];
+                    bool moved = fabsf(instance[3] - points.x[n]) > moveThreshold || fabsf(instance[4] - points.y[n]) > moveThreshold ||
+                                 fabsf(instance[5] - points.z[n]) > moveThreshold;
+                    if (moving || moved) {
+                        instance[0] = instance[3];
+                        instance[1] = instance[4];
+                        instance[2] = instance[5];
+                        instance[3] = points.x[n];
+                        instance[4] = points.y[n];
+                        instance[5] = points.z[n];
+                        instances.markDirty(index);
+                    }
+                }
+                instances.lastSeen[index] = frameNumber;
             }
-
-            // duplicate indices
-            const int N = indexBuffer.size();
-            for(int i = 0; i < N; i++){
-                renderingIndices.push_back(indexBuffer.at(i) + renderingIndicesCount);
+            // Backwards, so the instance moved into a hole has been checked already
+            for (uint32_t i = instances.size(); i-- > 0;) {
+                if (instances.lastSeen[i] != frameNumber) {
+                    instances.remove(instances.handle(i));
+                }
             }
-
-            renderingVerticesCount += vertexCount;
-            renderingIndicesCount += indexCount;
-
+            previousArrival = (frameNumber > 1) ? currentArrival : arrival;
+            currentArrival = arrival;
         }
 
-        void updateOneObject(int size, int stride, int offset, float x, float y, float z){
-            int currentSize = size * offset;
-            for(int i = 0; i < size; i += stride){
-                renderingVertices[currentSize + i] = vertexBuffer[i] + x;
-                renderingVertices[currentSize + i + 1] = vertexBuffer[i + 1] + y;
-                renderingVertices[currentSize + i + 2] = vertexBuffer[i + 2] + z;
-                renderingVertices[currentSize + i + 8] = 0.0f;
-                renderingVertices[currentSize + i + 9] = 0;
-                renderingVertices[currentSize + i + 10] = 0.5f;
+        /**
+        * Interpolation factor between the previous (0) and current (1) positions for a point in time
+        *
+        * The previous positions are shown when the current frame arrives, and the motion reaches the current positions
+        * one frame interval later, so the points move smoothly as long as the next frame arrives in time.
+        * Extrapolation shows the current positions on arrival and continues the motion past them instead (less latency,
+        * but overshoots when the motion changes).
+        *
+        * @param extrapolate Extrapolate beyond the current positions instead of interpolating towards them
+        * @param maxExtrapolation Limit of the extrapolation in frame intervals past the current positions
+        */
+        float interpolationAlpha(std::chrono::steady_clock::time_point now, bool extrapolate, float maxExtrapolation = 1.0f) const {
+            double interval = std::chrono::duration<double>(currentArrival - previousArrival).count();
+            if (interval <= 0.0) {
+                // No previous frame to move from
+                return 1.0f;
             }
-        }
-
-        void clearRenderingData(){
-            renderingVertices.clear();
-            renderingIndices.clear();
-            renderingVerticesCount = 0;
-            renderingIndicesCount = 0;
-        }
-
-        void duplicateObjects(std::vector<float> &positions) {
-            const int posSize = positions.size();
-            if (posSize == prePosSize) {
-                int offset = 0;
-                int size = vertexBuffer.size();
-                int stride = size / vertexCount;
-                for (int n = 0; n < posSize; n += 3) {
-                    updateOneObject(size, stride, offset, positions[n], positions[n + 1],
-                                    positions[n + 2]);
-                    offset++;
-                }
-            } else {
-                clearRenderingData();
-                for (int n = 0; n < posSize; n += 3) {
-                    glm::vec3 center = glm::vec3(positions[n], positions[n + 1], positions[n + 2]);
-                    duplicateOneObject(center);
-                }
-                prePosSize = posSize;
+            float alpha = static_cast<float>(std::chrono::duration<double>(now - currentArrival).count() / interval);
+            if (extrapolate) {
+                return 1.0f + glm::clamp(alpha, 0.0f, maxExtrapolation);
             }
+            return glm::clamp(alpha, 0.0f, 1.0f);
         }
 
     };
@@ -20,62 +20,183 @@
 #include "vulkanexamplebase.h"
 #include "VulkanModel.hpp"
 #include "VulkanBuffer.hpp"
+#include "VulkanUploadQueue.hpp"
+#include "threadpool.hpp"
+#include "VulkanTimestampQueries.hpp"
 #include "TraceTime.hpp"
 #include "DataStream.hpp"
 #include "../imagetargets/ShareData.h"
 
 #define VERTEX_BUFFER_BIND_ID 0
+#define INSTANCE_BUFFER_BIND_ID 1
 #define ENABLE_VALIDATION false
+// Upper limit for the number of command recording threads
+#define MAX_THREAD_COUNT 8
 
 class VulkanExample: public VulkanExampleBase 
 {
 public:
-	// Vertex layout for the models
+	// Vertex layout for the models, packed to 20 bytes per vertex (44 bytes as floats)
 	vks::VertexLayout vertexLayout = vks::VertexLayout({
-		vks::VERTEX_COMPONENT_POSITION,
-		vks::VERTEX_COMPONENT_NORMAL,
-		vks::VERTEX_COMPONENT_UV,
-		vks::VERTEX_COMPONENT_COLOR,
+		vks::VERTEX_COMPONENT_POSITION_SNORM16,
+		vks::VERTEX_COMPONENT_NORMAL_OCT16,
+		vks::VERTEX_COMPONENT_UV_HALF,
+		vks::VERTEX_COMPONENT_COLOR_RGBA8,
 	});
 
 	struct {
 		vks::Model cube;
 	} models;
 
+	// Ring of uniform buffer slots, one per swap chain image, bound as a dynamic uniform buffer
+	// so updating the data of one frame never races the GPU reading it for another frame
 	vks::Buffer uniformBuffer;
+	VkDeviceSize uniformSlotSize = 0;
+	uint32_t uniformSlotCount = 0;
+
+	// Streams the staged instance updates on the transfer queue, one slot per swap chain image
+	vks::UploadQueue *uploadQueue = nullptr;
 
 	// Same uniform buffer layout as shader
 	struct UBOVS {
 		glm::mat4 projection;
 		glm::mat4 modelView;
 		glm::vec4 lightPos = glm::vec4(0.0f, 2.0f, 1.0f, 0.0f);
+		// Bounds box the positions are quantized to (see vks::VertexBounds)
+		glm::vec4 positionCenter = glm::vec4(0.0f);
+		glm::vec4 positionExtent = glm::vec4(1.0f);
 	} uboVS;
 
+	// Interpolation factor between the previous and current instance positions of the frame being drawn (see vks::ModelX::interpolationAlpha)
+	// The only per frame input of the interpolation, so the positions are only uploaded when a new frame arrives
+	// The impostor pipeline also takes the bounding sphere (center relative to the instance, radius) and color of the mesh type it draws
+	struct PushConstants {
+		float alpha = 1.0f;
+		float padding[3];
+		glm::vec4 impostorSphere = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		glm::vec4 impostorColor = glm::vec4(1.0f);
+	} pushConstants;
+	// Extrapolate past the latest frame from the server instead of interpolating towards it (-extrapolate)
+	bool extrapolate = false;
+
 	VkPipelineLayout pipelineLayout;
-	VkDescriptorSet descriptorSet;
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
 	VkDescriptorSetLayout descriptorSetLayout;
 
 	struct {
 		VkPipeline phong;
+		// Sphere impostor per instance, for point counts the full meshes can't keep up with
+		// Only created if its shaders are packaged, otherwise everything is drawn as meshes
+		VkPipeline impostor = VK_NULL_HANDLE;
 	} pipelines;
 
+	// Shader stages of the pipelines, the modules are created separately so they can be loaded while the render pass is set up
+	struct {
+		std::array<VkPipelineShaderStageCreateInfo, 2> phong;
+		std::array<VkPipelineShaderStageCreateInfo, 2> impostor;
+	} shaderStages;
+
+	// Draw the instances as impostors instead of meshes, resolved from the stream's render mode before each frame
+	bool drawImpostors = false;
+	// The impostor shaders are packaged (see loadShaders), without them no instance is drawn as an impostor
+	bool impostorsAvailable = false;
+	// Result of the frustum query on the spatial index for the overlay (kept to avoid allocations per update)
+	std::vector<uint32_t> visiblePoints;
+	// Draw the mesh buckets of a draw group with a single multi-draw (needs the multiDrawIndirect and drawIndirectFirstInstance features)
+	bool multiDraw = false;
+	// Mesh types of the stream's points (see vks::ModelX::meshTypes), the mesh channel of a point is an index into this list
+	// More types are added with -mesh <file> <scale> (relative to the assets)
+	std::vector<vks::MeshFile> meshFiles = {
+		{ "models/cube.dae", 40.0f },
+	};
+	// Streams in STREAM_RENDER_AUTO mode switch to impostors above this number of points
+	uint32_t impostorThreshold = 20000;
+	// The levels of detail are selected with each stream frame (which is uploaded anyway), a stream that stopped
+	// sending frames gets its levels refreshed at this interval (in milliseconds) instead of on every camera move
+	float lodRefreshInterval = 1000.0f;
+	std::chrono::steady_clock::time_point lastLodSelection;
+
+	// The scene is recorded every frame into secondary command buffers, one draw group per worker thread
+	vks::ThreadPool threadPool;
+	uint32_t numThreads;
+
+	// Command buffers of a worker thread, its command pool is only used by that thread
+	struct ThreadData {
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		// One secondary command buffer per swap chain image
+		std::vector<VkCommandBuffer> commandBuffers;
+	};
+	std::vector<ThreadData> threadData;
+
+	// Secondary command buffers for the text overlay (one per swap chain image), recorded on the render thread
+	std::vector<VkCommandBuffer> overlayCmdBuffers;
+
+	// GPU timestamps, one slot per swap chain image read back once the image's fence has been waited on
+	vks::TimestampQueries *timestamps = nullptr;
+	enum { TIMESTAMP_PASS_BEGIN, TIMESTAMP_PASS_END, TIMESTAMP_OVERLAY_BEGIN, TIMESTAMP_OVERLAY_END, TIMESTAMP_COUNT };
+
+	// Rolling averages of the GPU times in milliseconds
+	struct {
+		double pass = 0.0;
+		double overlay = 0.0;
+		double upload = 0.0;
+		uint32_t frames = 0;
+	} gpuTimes;
+	// Number of frames between two GPU times written to the trace output
+	const uint32_t gpuTraceInterval = 60;
+
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
 		zoom = -4.5f;
 		rotation = glm::vec3(10.0f, 5.0f, 0.0f);
 		enableTextOverlay = true;
 		title = "Holostage";
+
+		numThreads = std::thread::hardware_concurrency();
+		if (numThreads == 0) {
+			numThreads = 1;
+		}
+		if (numThreads > MAX_THREAD_COUNT) {
+			numThreads = MAX_THREAD_COUNT;
+		}
+		threadPool.setThreadCount(numThreads);
+		threadData.resize(numThreads);
+		// Each thread draws its own range of the model's instances
+		models.cube.drawGroupCount = numThreads;
+
+		for (size_t i = 0; i < args.size(); i++) {
+			if (args[i] == std::string("-extrapolate")) {
+				extrapolate = true;
+			}
+			if ((args[i] == std::string("-mesh")) && (i + 2 < args.size())) {
+				float scale = (float)atof(args[i + 2]);
+				meshFiles.push_back({ args[i + 1], scale > 0.0f ? scale : 1.0f });
+			}
+		}
 	}
 
 	~VulkanExample()
 	{
+		// Frames may still be in flight, the upload queue waits for its own uploads
+		waitForFrames();
+
 		// Clean up used Vulkan resources 
 		// Note : Inherited destructor cleans up resources stored in base class
 		vkDestroyPipeline(device, pipelines.phong, nullptr);
+		vkDestroyPipeline(device, pipelines.impostor, nullptr);
 		
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
+		// Also frees the threads' command buffers
+		for (auto& thread : threadData) {
+			vkDestroyCommandPool(device, thread.commandPool, nullptr);
+		}
+
+		delete timestamps;
+
+		// Waits for pending uploads
+		delete uploadQueue;
 		models.cube.destroy();
 		uniformBuffer.destroy();
 	}
@@ -91,11 +212,210 @@ public:
 				enabledFeatures.wideLines = VK_TRUE;
 			}
 		};
+		// All mesh buckets of a draw group in one indirect draw, the draws select their instances with the first instance
+		if (deviceFeatures.multiDrawIndirect && deviceFeatures.drawIndirectFirstInstance) {
+			enabledFeatures.multiDrawIndirect = VK_TRUE;
+			enabledFeatures.drawIndirectFirstInstance = VK_TRUE;
+			multiDraw = true;
+			models.cube.useFirstInstance = true;
+		}
 	}
 
+	// Command buffers are recorded every frame (see recordCommandBuffer), this only (re)creates the per image resources
+	// Must not be called while frames are in flight
 	void buildCommandBuffers()
 	{		 
+		if (uniformSlotCount < drawCmdBuffers.size())
+		{
+			// The swap chain has more images than uniform slots (e.g. after a resize)
+			prepareUniformBuffers();
+		}
+
+		prepareSecondaryCommandBuffers();
+
+		// One timestamp slot per swap chain image
+		delete timestamps;
+		timestamps = new vks::TimestampQueries(vulkanDevice, swapChain.queueNodeIndex, static_cast<uint32_t>(drawCmdBuffers.size()), TIMESTAMP_COUNT);
+
+		// Each swap chain image draws from its own region of the instance and indirect buffers, written once its previous frame has finished
+		// so new stream frames never wait for the frames in flight (see updateFrameInstances)
+		models.cube.setFrameCount(vulkanDevice, static_cast<uint32_t>(drawCmdBuffers.size()));
+		delete uploadQueue;
+		uploadQueue = new vks::UploadQueue(vulkanDevice, transferQueue, queue, static_cast<uint32_t>(drawCmdBuffers.size()));
+	}
+
+	// Read back the GPU times of the last frame rendered to a swap chain image, without waiting
+	// The frame's fence must have been waited on (see prepareFrame)
+	void collectGpuTimes(uint32_t imageIndex)
+	{
+		if (!timestamps->collect(imageIndex)) {
+			return;
+		}
+
+		const double weight = 0.1;
+		gpuTimes.pass += (timestamps->elapsed(imageIndex, TIMESTAMP_PASS_BEGIN, TIMESTAMP_PASS_END) - gpuTimes.pass) * weight;
+		gpuTimes.overlay += (timestamps->elapsed(imageIndex, TIMESTAMP_OVERLAY_BEGIN, TIMESTAMP_OVERLAY_END) - gpuTimes.overlay) * weight;
+		gpuTimes.upload += (uploadQueue->lastUploadTime - gpuTimes.upload) * weight;
+
+		if (++gpuTimes.frames >= gpuTraceInterval) {
+			gpuTimes.frames = 0;
+			// Written in microseconds
+			output("GpuPass", static_cast<int>(gpuTimes.pass * 1000.0), __LINE__);
+			output("GpuOverlay", static_cast<int>(gpuTimes.overlay * 1000.0), __LINE__);
+			output("GpuUpload", static_cast<int>(gpuTimes.upload * 1000.0), __LINE__);
+		}
+	}
+
+	// (Re)allocate the secondary command buffers of all threads and the text overlay for the current swap chain images
+	void prepareSecondaryCommandBuffers()
+	{
+		uint32_t imageCount = static_cast<uint32_t>(drawCmdBuffers.size());
+
+		for (auto& thread : threadData)
+		{
+			if (thread.commandPool == VK_NULL_HANDLE)
+			{
+				// One pool per thread, command pools must not be used from multiple threads at the same time
+				VkCommandPoolCreateInfo cmdPoolInfo = vks::initializers::commandPoolCreateInfo();
+				cmdPoolInfo.queueFamilyIndex = swapChain.queueNodeIndex;
+				cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+				VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &thread.commandPool));
+			}
+			if (!thread.commandBuffers.empty())
+			{
+				vkFreeCommandBuffers(device, thread.commandPool, static_cast<uint32_t>(thread.commandBuffers.size()), thread.commandBuffers.data());
+			}
+			thread.commandBuffers.resize(imageCount);
+			VkCommandBufferAllocateInfo allocateInfo = vks::initializers::commandBufferAllocateInfo(thread.commandPool, VK_COMMAND_BUFFER_LEVEL_SECONDARY, imageCount);
+			VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocateInfo, thread.commandBuffers.data()));
+		}
+
+		if (!overlayCmdBuffers.empty())
+		{
+			vkFreeCommandBuffers(device, cmdPool, static_cast<uint32_t>(overlayCmdBuffers.size()), overlayCmdBuffers.data());
+		}
+		overlayCmdBuffers.resize(imageCount);
+		VkCommandBufferAllocateInfo allocateInfo = vks::initializers::commandBufferAllocateInfo(cmdPool, VK_COMMAND_BUFFER_LEVEL_SECONDARY, imageCount);
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocateInfo, overlayCmdBuffers.data()));
+	}
+
+	// Record the draw group of a worker thread into its secondary command buffer for a swap chain image
+	// Called from the worker thread
+	void recordDrawGroup(uint32_t threadIndex, uint32_t imageIndex, VkCommandBufferInheritanceInfo inheritanceInfo)
+	{
+		// Recorded through the device's dispatch table, skipping the loader trampolines
+		const vks::DeviceDispatch &vk = vulkanDevice->dispatch;
+		VkCommandBuffer cmdBuffer = threadData[threadIndex].commandBuffers[imageIndex];
+
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		cmdBufInfo.pInheritanceInfo = &inheritanceInfo;
+
+		VK_CHECK_RESULT(vk.BeginCommandBuffer(cmdBuffer, &cmdBufInfo));
+
+		VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+		vk.CmdSetViewport(cmdBuffer, 0, 1, &viewport);
+
+		VkRect2D scissor = vks::initializers::rect2D(width, height,	0, 0);
+		vk.CmdSetScissor(cmdBuffer, 0, 1, &scissor);
+
+		// Read the uniform slot of the swap chain image
+		uint32_t dynamicOffset = imageIndex * static_cast<uint32_t>(uniformSlotSize);
+		vk.CmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 1, &dynamicOffset);
+
+		// One draw per bucket (mesh type and level of detail): the mesh levels with their index range, the rest as impostors
+		// The instance counts are sourced from the indirect buffers, the host copy only skips the empty draws
+		const vks::ModelX &model = models.cube.model;
+		const uint32_t buckets = model.bucketCount();
+
+		if (!drawImpostors) {
+			vk.CmdBindIndexBuffer(cmdBuffer, models.cube.indices.buffer, 0, models.cube.indexType);
+			vk.CmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.phong);
+			vk.CmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(pushConstants), &pushConstants);
+			VkBuffer vertexBuffers[2] = { models.cube.vertices.buffer, models.cube.instanceData.buffer };
+
+			if (multiDraw) {
+				// The draws pass their first instance (relative to the image's region), the impostor buckets have no instances in these commands
+				VkDeviceSize offsets[2] = { 0, models.cube.frameOffset(imageIndex) };
+				vk.CmdBindVertexBuffers(cmdBuffer, VERTEX_BUFFER_BIND_ID, 2, vertexBuffers, offsets);
+				uint32_t draw = models.cube.drawIndex(0, threadIndex);
+				vk.CmdDrawIndexedIndirect(cmdBuffer, models.cube.drawCommand.buffer, models.cube.drawCommandOffset(draw, imageIndex), buckets, sizeof(VkDrawIndexedIndirectCommand));
+			} else {
+				for (uint32_t bucket = 0; bucket < buckets; bucket++) {
+					uint32_t draw = models.cube.drawIndex(bucket, threadIndex);
+					if (!model.isMeshBucket(bucket) || models.cube.drawInstanceCount[draw] == 0) {
+						continue;
+					}
+					// Each draw's instances start at its offset of the image's region of the instance buffer
+					VkDeviceSize offsets[2] = { 0, models.cube.instanceOffset(bucket, threadIndex, imageIndex) };
+					vk.CmdBindVertexBuffers(cmdBuffer, VERTEX_BUFFER_BIND_ID, 2, vertexBuffers, offsets);
+					vk.CmdDrawIndexedIndirect(cmdBuffer, models.cube.drawCommand.buffer, models.cube.drawCommandOffset(draw, imageIndex), 1, sizeof(VkDrawIndexedIndirectCommand));
+				}
+			}
+		}
+
+		// The quad corners are generated in the vertex shader, only the instances are read from a buffer
+		if (impostorsAvailable) {
+			vk.CmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.impostor);
+		}
+		for (uint32_t bucket = 0; impostorsAvailable && (bucket < buckets); bucket++) {
+			uint32_t draw = models.cube.drawIndex(bucket, threadIndex);
+			if ((!drawImpostors && model.isMeshBucket(bucket)) || models.cube.drawInstanceCount[draw] == 0) {
+				continue;
+			}
+			const vks::ModelX::MeshType &type = model.meshTypes[model.typeOfBucket(bucket)];
+			PushConstants impostorConstants = pushConstants;
+			impostorConstants.impostorSphere = glm::vec4(type.center, type.radius);
+			impostorConstants.impostorColor = glm::vec4(type.materialColor, 1.0f);
+			vk.CmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(impostorConstants), &impostorConstants);
+
+			VkDeviceSize instanceOffset = models.cube.instanceOffset(bucket, threadIndex, imageIndex);
+			vk.CmdBindVertexBuffers(cmdBuffer, INSTANCE_BUFFER_BIND_ID, 1, &models.cube.instanceData.buffer, &instanceOffset);
+			vk.CmdDrawIndirect(cmdBuffer, models.cube.impostorDrawCommand.buffer, models.cube.impostorDrawCommandOffset(draw, imageIndex), 1, sizeof(VkDrawIndirectCommand));
+		}
+
+		VK_CHECK_RESULT(vk.EndCommandBuffer(cmdBuffer));
+	}
+
+	// Record the primary command buffer of a swap chain image
+	// The draw groups are recorded in parallel, the primary command buffer only executes them inside the render pass
+	// The previous frame using this image must have finished (see prepareFrame)
+	void recordCommandBuffer(uint32_t imageIndex)
+	{
+		const vks::DeviceDispatch &vk = vulkanDevice->dispatch;
+		VkCommandBufferInheritanceInfo inheritanceInfo = vks::initializers::commandBufferInheritanceInfo();
+		inheritanceInfo.renderPass = renderPass;
+		inheritanceInfo.subpass = 0;
+		inheritanceInfo.framebuffer = frameBuffers[imageIndex];
+
+		for (uint32_t t = 0; t < numThreads; t++)
+		{
+			threadPool.threads[t]->addJob([=] { recordDrawGroup(t, imageIndex, inheritanceInfo); });
+		}
+
+		// Text overlay on top of the scene, recorded while the workers are busy
+		VkCommandBuffer overlayCmdBuffer = overlayCmdBuffers[imageIndex];
+		VkCommandBufferBeginInfo overlayBeginInfo = vks::initializers::commandBufferBeginInfo();
+		overlayBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		overlayBeginInfo.pInheritanceInfo = &inheritanceInfo;
+		VK_CHECK_RESULT(vk.BeginCommandBuffer(overlayCmdBuffer, &overlayBeginInfo));
+		timestamps->write(overlayCmdBuffer, imageIndex, TIMESTAMP_OVERLAY_BEGIN, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+		drawTextOverlay(overlayCmdBuffer, imageIndex);
+		timestamps->write(overlayCmdBuffer, imageIndex, TIMESTAMP_OVERLAY_END, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+		VK_CHECK_RESULT(vk.EndCommandBuffer(overlayCmdBuffer));
+
+		threadPool.wait();
+
+		std::vector<VkCommandBuffer> secondaryCmdBuffers;
+		secondaryCmdBuffers.reserve(numThreads + 1);
+		for (auto& thread : threadData)
+		{
+			secondaryCmdBuffers.push_back(thread.commandBuffers[imageIndex]);
+		}
+		secondaryCmdBuffers.push_back(overlayCmdBuffer);
+
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
 		VkClearValue clearValues[2];
 		clearValues[0].color = defaultClearColor;
@@ -109,51 +429,45 @@ public:
 		renderPassBeginInfo.renderArea.extent.height = height;
 		renderPassBeginInfo.clearValueCount = 2;
 		renderPassBeginInfo.pClearValues = clearValues;
+		renderPassBeginInfo.framebuffer = frameBuffers[imageIndex];
 
-		for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
-		{
-			// Set target frame buffer
-			renderPassBeginInfo.framebuffer = frameBuffers[i];
-
-			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
-
-			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
-			vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
-
-			VkRect2D scissor = vks::initializers::rect2D(width, height,	0, 0);
-			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+		VkCommandBuffer cmdBuffer = drawCmdBuffers[imageIndex];
 
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+		VK_CHECK_RESULT(vk.BeginCommandBuffer(cmdBuffer, &cmdBufInfo));
 
-			VkDeviceSize offsets[1] = { 0 };
-			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &models.cube.vertices.buffer, offsets);
-			vkCmdBindIndexBuffer(drawCmdBuffers[i], models.cube.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+		timestamps->reset(cmdBuffer, imageIndex);
+		timestamps->write(cmdBuffer, imageIndex, TIMESTAMP_PASS_BEGIN, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
 
-			// Left : Solid colored 
-			viewport.width = (float)width;
-			vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
-			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.phong);
-			
-			vkCmdDrawIndexed(drawCmdBuffers[i], models.cube.indexCount, 1, 0, 0, 0);
+		// The render pass contents are provided by secondary command buffers only
+		vk.CmdBeginRenderPass(cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		vk.CmdExecuteCommands(cmdBuffer, static_cast<uint32_t>(secondaryCmdBuffers.size()), secondaryCmdBuffers.data());
+		vk.CmdEndRenderPass(cmdBuffer);
 
-			vkCmdEndRenderPass(drawCmdBuffers[i]);
+		timestamps->write(cmdBuffer, imageIndex, TIMESTAMP_PASS_END, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
 
-			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
-		}
+		VK_CHECK_RESULT(vk.EndCommandBuffer(cmdBuffer));
 	}
 
-	void loadAssets()
+	void loadShaders()
 	{
-        models.cube.loadFromFile(getAssetPath() + "models/cube.dae", vertexLayout, 40.0f, vulkanDevice, queue);
+		shaderStages.phong[0] = loadShader(getAssetPath() + "shaders/pipelines/phong.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+		shaderStages.phong[1] = loadShader(getAssetPath() + "shaders/pipelines/phong.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+		const std::string impostorVert = getAssetPath() + "shaders/pipelines/impostor.vert.spv";
+		const std::string impostorFrag = getAssetPath() + "shaders/pipelines/impostor.frag.spv";
+		impostorsAvailable = assetExists(impostorVert) && assetExists(impostorFrag);
+		if (!impostorsAvailable) {
+			LOGE("Impostor shaders not found, the points are drawn as meshes only");
+			return;
+		}
+		shaderStages.impostor[0] = loadShader(impostorVert, VK_SHADER_STAGE_VERTEX_BIT);
+		shaderStages.impostor[1] = loadShader(impostorFrag, VK_SHADER_STAGE_FRAGMENT_BIT);
 	}
 
 	void setupDescriptorPool()
 	{
 		std::vector<VkDescriptorPoolSize> poolSizes =
 		{
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1)
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1)
 		};
 
 		VkDescriptorPoolCreateInfo descriptorPoolInfo =
@@ -169,9 +483,9 @@ public:
 	{
 		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings =
 		{
-			// Binding 0 : Vertex shader uniform buffer
+			// Binding 0 : Vertex shader uniform buffer (one slot per frame, selected by the dynamic offset)
 			vks::initializers::descriptorSetLayoutBinding(
-				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
 				VK_SHADER_STAGE_VERTEX_BIT,
 				0)
 		};
@@ -188,6 +502,15 @@ public:
 				&descriptorSetLayout,
 				1);
 
+		// Interpolation factor of the instance positions
+		VkPushConstantRange pushConstantRange =
+			vks::initializers::pushConstantRange(
+				VK_SHADER_STAGE_VERTEX_BIT,
+				sizeof(pushConstants),
+				0);
+		pPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+		pPipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &pipelineLayout));
 	}
 
@@ -201,12 +524,17 @@ public:
 
 		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
 
+		updateDescriptorSet();
+	}
+
+	void updateDescriptorSet()
+	{
 		std::vector<VkWriteDescriptorSet> writeDescriptorSets =
 		{
 			// Binding 0 : Vertex shader uniform buffer
 			vks::initializers::writeDescriptorSet(
 				descriptorSet,
-				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
 				0,
 				&uniformBuffer.descriptor)
 		};
@@ -262,8 +590,6 @@ public:
 		VkGraphicsPipelineCreateInfo pipelineCreateInfo =
 			vks::initializers::pipelineCreateInfo(pipelineLayout, renderPass);
 
-		std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages;
-
 		pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
 		pipelineCreateInfo.pRasterizationState = &rasterizationState;
 		pipelineCreateInfo.pColorBlendState = &colorBlendState;
@@ -271,23 +597,23 @@ public:
 		pipelineCreateInfo.pViewportState = &viewportState;
 		pipelineCreateInfo.pDepthStencilState = &depthStencilState;
 		pipelineCreateInfo.pDynamicState = &dynamicState;
-		pipelineCreateInfo.stageCount = shaderStages.size();
-		pipelineCreateInfo.pStages = shaderStages.data();
+		pipelineCreateInfo.stageCount = shaderStages.phong.size();
+		pipelineCreateInfo.pStages = shaderStages.phong.data();
 
 		// Shared vertex bindings and attributes used by all pipelines
 
 		// Binding description
 		std::vector<VkVertexInputBindingDescription> vertexInputBindings = {
 			vks::initializers::vertexInputBindingDescription(VERTEX_BUFFER_BIND_ID, vertexLayout.stride(), VK_VERTEX_INPUT_RATE_VERTEX),
+			vks::initializers::vertexInputBindingDescription(INSTANCE_BUFFER_BIND_ID, vks::ModelX::instanceFloats * sizeof(float), VK_VERTEX_INPUT_RATE_INSTANCE),
 		};
 
-		// Attribute descriptions
-		std::vector<VkVertexInputAttributeDescription> vertexInputAttributes = {
-			vks::initializers::vertexInputAttributeDescription(VERTEX_BUFFER_BIND_ID, 0, VK_FORMAT_R32G32B32_SFLOAT, 0),					// Location 0: Position			
-			vks::initializers::vertexInputAttributeDescription(VERTEX_BUFFER_BIND_ID, 1, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 3),	// Location 1: Color			
-			vks::initializers::vertexInputAttributeDescription(VERTEX_BUFFER_BIND_ID, 2, VK_FORMAT_R32G32_SFLOAT, sizeof(float) * 6),		// Location 2 : Texture coordinates			
-			vks::initializers::vertexInputAttributeDescription(VERTEX_BUFFER_BIND_ID, 3, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 8),	// Location 3 : Normal
-		};
+		// Attribute descriptions, generated from the vertex layout
+		// Location 0 : Position, Location 1 : Normal, Location 2 : Texture coordinates, Location 3 : Color
+		std::vector<VkVertexInputAttributeDescription> vertexInputAttributes = vertexLayout.attributeDescriptions(VERTEX_BUFFER_BIND_ID);
+		// Location 4 : Previous instance position, Location 5 : Current instance position
+		vertexInputAttributes.push_back(vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 4, VK_FORMAT_R32G32B32_SFLOAT, 0));
+		vertexInputAttributes.push_back(vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 5, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 3));
 
 		VkPipelineVertexInputStateCreateInfo vertexInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
 		vertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexInputBindings.size());
@@ -306,9 +632,7 @@ public:
 		pipelineCreateInfo.flags = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
 
 		// Textured pipeline
-		// Phong shading pipeline
-		shaderStages[0] = loadShader(getAssetPath() + "shaders/pipelines/phong.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
-		shaderStages[1] = loadShader(getAssetPath() + "shaders/pipelines/phong.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+		// Phong shading pipeline (shader modules from loadShaders)
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipelines.phong));
 
 		// All pipelines created after the base pipeline will be derivatives
@@ -318,30 +642,89 @@ public:
 		// It's only allowed to either use a handle or index for the base pipeline
 		// As we use the handle, we must set the index to -1 (see section 9.5 of the specification)
 		pipelineCreateInfo.basePipelineIndex = -1;
+
+		if (!impostorsAvailable) {
+			return;
+		}
+
+		// Impostor pipeline
+		// One camera facing quad per instance as a strip of 4 generated vertices, the fragment shader ray casts a sphere
+		// and writes its depth, so impostors and meshes intersect correctly
+		inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+		rasterizationState.cullMode = VK_CULL_MODE_NONE;
+
+		// Location 0 : Previous instance position, Location 1 : Current instance position
+		std::vector<VkVertexInputBindingDescription> impostorInputBindings = {
+			vks::initializers::vertexInputBindingDescription(INSTANCE_BUFFER_BIND_ID, vks::ModelX::instanceFloats * sizeof(float), VK_VERTEX_INPUT_RATE_INSTANCE),
+		};
+		std::vector<VkVertexInputAttributeDescription> impostorInputAttributes = {
+			vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 0, VK_FORMAT_R32G32B32_SFLOAT, 0),
+			vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 1, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 3),
+		};
+		vertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(impostorInputBindings.size());
+		vertexInputState.pVertexBindingDescriptions = impostorInputBindings.data();
+		vertexInputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(impostorInputAttributes.size());
+		vertexInputState.pVertexAttributeDescriptions = impostorInputAttributes.data();
+
+		pipelineCreateInfo.stageCount = shaderStages.impostor.size();
+		pipelineCreateInfo.pStages = shaderStages.impostor.data();
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipelines.impostor));
 	}
 
 	// Prepare and initialize uniform buffer containing shader uniforms
+	// Must not be called while frames are in flight
 	void prepareUniformBuffers()
 	{
+		uniformBuffer.destroy();
+
+		// Dynamic offsets must be a multiple of the device's minimum uniform buffer offset alignment
+		VkDeviceSize minAlignment = vulkanDevice->properties.limits.minUniformBufferOffsetAlignment;
+		uniformSlotSize = sizeof(uboVS);
+		if (minAlignment > 0)
+		{
+			uniformSlotSize = (uniformSlotSize + minAlignment - 1) & ~(minAlignment - 1);
+		}
+		uniformSlotCount = static_cast<uint32_t>(drawCmdBuffers.size());
+
 		// Create the vertex shader uniform buffer block
 		VK_CHECK_RESULT(vulkanDevice->createBuffer(
 			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 			&uniformBuffer,
-			sizeof(uboVS)));
+			uniformSlotSize * uniformSlotCount));
+
+		// The descriptor covers a single slot
+		uniformBuffer.setupDescriptor(sizeof(uboVS));
 
 		// Map persistent
 		VK_CHECK_RESULT(uniformBuffer.map());
 
 		updateUniformBuffers();
+		for (uint32_t i = 0; i < uniformSlotCount; i++)
+		{
+			writeUniformSlot(i);
+		}
+
+		if (descriptorSet != VK_NULL_HANDLE)
+		{
+			updateDescriptorSet();
+		}
+	}
+
+	// Copy the current uniform data into the slot of a swap chain image
+	// The frame that last used the slot must have finished (see prepareFrame)
+	void writeUniformSlot(uint32_t slot)
+	{
+		memcpy(static_cast<char*>(uniformBuffer.mapped) + slot * uniformSlotSize, &uboVS, sizeof(uboVS));
 	}
 
     // Get the mvp matrix from Vuforia and put them in the Uniform buffer
-	void getMvp(){
+    // return true if a new pose has been taken
+	bool getMvp(){
 
         if(mvpUsed){
             // The mvp matrix from Vuforia has been used
-            return;
+            return false;
         }
 
         mvpUsed = true;
@@ -356,18 +739,91 @@ public:
         projection[14]=d;
         uboVS.projection = glm::make_mat4(projection);
         uboVS.modelView = glm::make_mat4(modelView);
-        if(uniformBuffer.mapped){
-            memcpy(uniformBuffer.mapped, &uboVS, sizeof(uboVS));
-        }
+        return true;
 
 	}
 
-    void updateVertexBuffer(){
-        bool bufferResized = models.cube.updateVertexBuffer(vulkanDevice, queue);
-        // rebuild commandbuffer
-        if(bufferResized){
-            buildCommandBuffers();
+    // return true if a new frame from the server or new levels of detail have been applied to the instances
+    bool updateVertexBuffer(){
+        // update the rendering data according to the configure data from server
+        models.cube.model.loadFromServer();
+        // the levels of detail only matter while meshes are drawn, rebucketing the instances re-uploads the moved ones
+        // to the region of every swap chain image, so it's done with the stream frames and not every time the camera moves
+        auto now = std::chrono::steady_clock::now();
+        bool refreshLods = std::chrono::duration<float, std::milli>(now - lastLodSelection).count() > lodRefreshInterval;
+        uint32_t lodChanges = 0;
+        if(!drawImpostors && (models.cube.model.isDataChanged || refreshLods)){
+            lodChanges = selectLods();
+            lastLodSelection = now;
+        }
+        if(!models.cube.model.isDataChanged && lodChanges == 0){
+            return false;
+        }
+        // only the host side, the region of each swap chain image is written once its previous frame has finished (see updateFrameInstances)
+        // command buffers are recorded every frame, so a reallocated buffer is picked up by the next frame
+        models.cube.updateInstances(vulkanDevice);
+        return true;
+    }
+
+    // Write the instances the image's region of the instance buffer misses and its indirect draw commands
+    // The frame that last used this image has finished, the other frames in flight keep reading their own regions
+    void updateFrameInstances(uint32_t imageIndex){
+        models.cube.updateFrame(vulkanDevice, imageIndex, queue, uploadQueue);
+    }
+
+    // Level of detail of the instances by their projected size with the current pose, returns the number of changed instances
+    uint32_t selectLods(){
+        // Projected size (pixels) of a length of 1 at a view distance of 1
+        float pixelScale = fabsf(uboVS.projection[1][1]) * (float)height * 0.5f;
+        // Streams that ask for meshes never fall back to impostors
+        bool impostors = impostorsAvailable && (models.cube.model.renderMode != STREAM_RENDER_MESH);
+        return models.cube.model.selectLods(uboVS.modelView, pixelScale, impostors);
+    }
+
+    // Planes of the view frustum of projection * modelView in the space of the stream's positions (from its rows, depth range 0..1)
+    static void frustumPlanes(const glm::mat4 &m, GridPlane planes[6]){
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++) {
+            rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+        }
+        const glm::vec4 p[6] = { rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[2], rows[3] - rows[2] };
+        for (int i = 0; i < 6; i++) {
+            planes[i] = { p[i].x, p[i].y, p[i].z, p[i].w };
+        }
+    }
+
+    // Pick meshes or impostors for the next frame, returns true if that changed
+    bool updateRenderMode(){
+        bool impostors;
+        switch (models.cube.model.renderMode) {
+            case STREAM_RENDER_MESH:
+                impostors = false;
+                break;
+            case STREAM_RENDER_IMPOSTOR:
+                impostors = true;
+                break;
+            default:
+                impostors = models.cube.instanceCount > impostorThreshold;
+                break;
         }
+        impostors = impostors && impostorsAvailable;
+        bool changed = (impostors != drawImpostors);
+        drawImpostors = impostors;
+        return changed;
+    }
+
+    // Interpolation factor for the frame about to be drawn, returns true while the instances are still moving
+    bool updateInterpolation(){
+        float alpha = models.cube.model.interpolationAlpha(std::chrono::steady_clock::now(), extrapolate);
+        bool moving = (alpha != pushConstants.alpha);
+        pushConstants.alpha = alpha;
+        return moving;
+    }
+
+    // The quantization box of the meshes' vertices, set once the meshes have been uploaded
+    void updateMeshUniforms(){
+        uboVS.positionCenter = glm::vec4(models.cube.bounds.center, 0.0f);
+        uboVS.positionExtent = glm::vec4(models.cube.bounds.extent, 0.0f);
     }
 
 	void updateUniformBuffers()
@@ -380,10 +836,6 @@ public:
 		uboVS.modelView = glm::rotate(uboVS.modelView, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
 		uboVS.modelView = glm::rotate(uboVS.modelView, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
 		uboVS.modelView = glm::rotate(uboVS.modelView, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-
-        if(uniformBuffer.mapped){
-            memcpy(uniformBuffer.mapped, &uboVS, sizeof(uboVS));
-        }
 	}
 
 	void draw()
@@ -394,23 +846,73 @@ public:
             LOGE("Error: resize the window.");
             return;
         }
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+
+		// The frame that last used this image has finished, so its uniform slot, instance region and command buffers can be overwritten
+		collectGpuTimes(currentBuffer);
+		writeUniformSlot(currentBuffer);
+		updateFrameInstances(currentBuffer);
+		recordCommandBuffer(currentBuffer);
+
+		// Wait for the swap chain image (not acquired in headless mode) and for the instance upload of this frame (if any)
+		VkSemaphore waitSemaphores[2];
+		VkPipelineStageFlags waitStages[2];
+		uint32_t waitCount = 0;
+		if (submitInfo.waitSemaphoreCount > 0) {
+			waitSemaphores[waitCount] = semaphores.presentComplete;
+			waitStages[waitCount++] = submitPipelineStages;
+		}
+		VkSemaphore uploadSemaphore = uploadQueue->takeWaitSemaphore();
+		if (uploadSemaphore != VK_NULL_HANDLE) {
+			waitSemaphores[waitCount] = uploadSemaphore;
+			waitStages[waitCount++] = uploadQueue->waitStage;
+		}
+
+		VkSubmitInfo frameSubmitInfo = submitInfo;
+		frameSubmitInfo.waitSemaphoreCount = waitCount;
+		frameSubmitInfo.pWaitSemaphores = waitSemaphores;
+		frameSubmitInfo.pWaitDstStageMask = waitStages;
+		frameSubmitInfo.commandBufferCount = 1;
+		frameSubmitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
+		framePacer.beginSubmit();
+		VK_CHECK_RESULT(vulkanDevice->dispatch.QueueSubmit(queue, 1, &frameSubmitInfo, VK_NULL_HANDLE));
 
 		VulkanExampleBase::submitFrame();
 	}
 
+	// Startup runs as a dependency graph: the mesh import, shader modules and pipeline compilation run on the worker threads
+	// while the render thread sets up the swap chain resources, everything has finished before the first frame
 	void prepare()
 	{
-		VulkanExampleBase::prepare();
-		loadAssets();
-		prepareUniformBuffers();
-		setupDescriptorSetLayout();
-		preparePipelines();
-		setupDescriptorPool();
-		setupDescriptorSet();
-		buildCommandBuffers();
+		vks::TaskGraph startup;
+		// Tasks that submit to the graphics queue or use the base command pool stay on the render thread
+		const bool renderThread = true;
+
+		auto base = startup.add("base prepare", [this] { VulkanExampleBase::prepare(); }, {}, renderThread);
+		auto meshImport = startup.add("mesh import", [this] {
+			std::vector<vks::MeshFile> files = meshFiles;
+			for (auto& file : files) {
+				file.filename = getAssetPath() + file.filename;
+			}
+			models.cube.importFromFiles(files, vertexLayout);
+		});
+		auto shaders = startup.add("shader modules", [this] { loadShaders(); });
+		auto layouts = startup.add("descriptor set layout", [this] { setupDescriptorSetLayout(); });
+		// Needs the render pass and the pipeline cache of the base
+		startup.add("pipelines", [this] { preparePipelines(); }, { base, shaders, layouts });
+		auto meshUpload = startup.add("mesh upload", [this] {
+			models.cube.upload(vulkanDevice, queue);
+			updateMeshUniforms();
+		}, { meshImport }, renderThread);
+		// The uniform slots and command buffers depend on the number of swap chain images, the slots also hold the mesh's bounds
+		auto uniforms = startup.add("uniform buffers", [this] { prepareUniformBuffers(); }, { base, meshUpload });
+		startup.add("descriptor sets", [this] {
+			setupDescriptorPool();
+			setupDescriptorSet();
+		}, { layouts, uniforms });
+		// Also sizes the instance regions and the upload queue to the swap chain images
+		startup.add("command buffers", [this] { buildCommandBuffers(); }, { base, uniforms }, renderThread);
+
+		startup.run(threadPool, &startupTimeline);
 		prepared = true;
 	}
 
@@ -420,12 +922,30 @@ public:
 			return;
 
         // Get the MVP matrix from Vuforia
-        getMvp();
+        if(getMvp()){
+            requestFrame();
+        }
 
         // Initiation. For measuring the time
         models.cube.model.renderingStartTime = -1;
 
-        updateVertexBuffer();
+        if(updateVertexBuffer()){
+            requestFrame();
+        }
+
+        // Keep drawing at the display rate while the instances move towards the latest positions
+        if(updateInterpolation()){
+            requestFrame();
+        }
+
+        if(updateRenderMode()){
+            requestFrame();
+        }
+
+        // Skip the frame if neither the pose, the stream nor the overlay changed
+        if(!frameRequired()){
+            return;
+        }
 
 		draw();
 
@@ -442,6 +962,7 @@ public:
 	virtual void viewChanged()
 	{
 		updateUniformBuffers();
+		requestFrame();
 	}
 
 	virtual void getOverlayText(VulkanTextOverlay *textOverlay)
@@ -450,6 +971,36 @@ public:
 			textOverlay->addText("Non solid fill modes not supported!", width - (float)width / 6.5f, (float)height / 2.0f - 7.5f, VulkanTextOverlay::alignCenter);
 		}
 
+		if (timestamps && timestamps->supported()) {
+			std::stringstream ss;
+			ss << std::fixed << std::setprecision(2) << "GPU: pass " << gpuTimes.pass << "ms overlay " << gpuTimes.overlay << "ms upload " << gpuTimes.upload << "ms";
+			textOverlay->addText(ss.str(), 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+		}
+
+		// Share of the instances the last stream frame changed (and uploaded)
+		std::stringstream ss;
+		ss << (drawImpostors ? "impostors: " : "instances: ") << models.cube.instanceCount << " uploaded: " << models.cube.uploadedInstances << " in " << models.cube.copyRegions.size() << " regions";
+		textOverlay->addText(ss.str(), 5.0f, 105.0f, VulkanTextOverlay::alignLeft);
+
+		// Instances per mesh type and level of detail, the last level of each type is drawn as impostors
+		std::stringstream lods;
+		lods << "lod:";
+		const vks::ModelX &model = models.cube.model;
+		for (uint32_t bucket = 0; bucket < model.bucketCount(); bucket++) {
+			lods << ((bucket > 0 && model.levelOfBucket(bucket) == 0) ? " | " : " ") << model.instances.bucketRange(bucket).count;
+		}
+		textOverlay->addText(lods.str(), 5.0f, 125.0f, VulkanTextOverlay::alignLeft);
+
+		// Points in the view frustum by the spatial index, and the cost of keeping the index up to date
+		const SpatialGrid &grid = model.spatialIndex;
+		GridPlane planes[6];
+		frustumPlanes(uboVS.projection * uboVS.modelView, planes);
+		grid.queryPlanes(planes, 6, visiblePoints);
+		std::stringstream index;
+		index << std::fixed << std::setprecision(2) << "grid: visible " << visiblePoints.size() << " of " << grid.size() << " cells " << grid.cellCount()
+			  << (grid.stats.lastWasRebuild ? " rebuild " : " update ") << grid.stats.lastMs << "ms overflow " << grid.overflowCount();
+		textOverlay->addText(index.str(), 5.0f, 145.0f, VulkanTextOverlay::alignLeft);
+
 		// test
 //		saveFPSData();
 //
@@ -502,6 +1053,151 @@ void timerCall(){
 //    vulkanExample->saveFPSData();
 }
 
+#if defined(_HEADLESS)
+// Random position in [-extent, extent) on each axis
+static void randomPoint(float extent, float p[3])
+{
+    for (int k = 0; k < 3; k++) {
+        p[k] = ((float)rand() / (float)RAND_MAX * 2.0f - 1.0f) * extent;
+    }
+}
+
+static void benchmarkSpatialGrid()
+{
+    const uint32_t pointCounts[] = { 100000, 1000000 };
+    const uint32_t queries = 1000;
+    for (uint32_t pointCount : pointCounts) {
+        // the same density for every count, around 1 point per 10 x 10 x 10
+        const float extent = 0.5f * cbrtf((float)pointCount) * 10.0f;
+        srand(1);
+        PointFrame points;
+        points.reserve(pointCount);
+        for (uint32_t i = 0; i < pointCount; i++) {
+            float p[3];
+            randomPoint(extent, p);
+            points.push(p[0], p[1], p[2]);
+        }
+
+        SpatialGrid grid;
+        // around 8 points per cell
+        grid.cellSize = 20.0f;
+        grid.update(points);
+        double buildMs = grid.stats.lastMs;
+        __android_log_print(ANDROID_LOG_INFO, "SpatialGrid", "%u points: build %.2fms (%.2fms per 100k points), %u cells of %.1f",
+                            pointCount, buildMs, buildMs * 100000.0 / pointCount, grid.cellCount(), grid.usedCellSize());
+
+        // a frame that moves 1% of the points by up to 2 cells
+        for (uint32_t i = 0; i < pointCount / 100; i++) {
+            uint32_t n = (uint32_t)rand() % pointCount;
+            float d[3];
+            randomPoint(2.0f * grid.usedCellSize(), d);
+            points.x[n] = std::min(std::max(points.x[n] + d[0], -extent), extent);
+            points.y[n] = std::min(std::max(points.y[n] + d[1], -extent), extent);
+            points.z[n] = std::min(std::max(points.z[n] + d[2], -extent), extent);
+        }
+        grid.update(points);
+        __android_log_print(ANDROID_LOG_INFO, "SpatialGrid", "%u points: %s of 1%% moved points %.2fms, overflow %u",
+                            pointCount, grid.stats.lastWasRebuild ? "rebuild" : "update", grid.stats.lastMs, grid.overflowCount());
+
+        std::vector<uint32_t> result;
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t q = 0; q < queries; q++) {
+            float p[3];
+            randomPoint(extent, p);
+            grid.queryRadius(p[0], p[1], p[2], 20.0f, result);
+            found += result.size();
+        }
+        double radiusUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / queries;
+
+        uint32_t hits = 0;
+        start = std::chrono::steady_clock::now();
+        for (uint32_t q = 0; q < queries; q++) {
+            float o[3], d[3];
+            randomPoint(extent, o);
+            randomPoint(1.0f, d);
+            float length = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+            uint32_t hit;
+            float distance;
+            if (length > 0.0f && grid.queryRay(o[0], o[1], o[2], d[0] / length, d[1] / length, d[2] / length, 1.0f, 4.0f * extent, hit, distance)) {
+                hits++;
+            }
+        }
+        double rayUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / queries;
+
+        // a 60 degree frustum looking down -z from the front face of the points
+        glm::mat4 m = glm::perspective(glm::radians(60.0f), 1.0f, 1.0f, 2.0f * extent) * glm::translate(glm::mat4(), glm::vec3(0.0f, 0.0f, -extent));
+        GridPlane planes[6];
+        VulkanExample::frustumPlanes(m, planes);
+        start = std::chrono::steady_clock::now();
+        grid.queryPlanes(planes, 6, result);
+        double frustumMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        __android_log_print(ANDROID_LOG_INFO, "SpatialGrid", "%u points: radius query %.2fus (%.1f points), ray query %.2fus (%u%% hits), frustum query %.2fms (%zu points)",
+                            pointCount, radiusUs, (double)found / queries, rayUs, hits * 100 / queries, frustumMs, result.size());
+    }
+}
+
+// Headless benchmark on a Linux host (e.g. on lavapipe), the stream is played locally instead of received by the server
+// -stream <file>: recorded stream, -points <n>: synthetic stream of n x n points, -streamrate <fps>: 0 keeps one frame queued
+// -render <auto|mesh|impostor>: render mode of the stream, -meshtypes <n>: mesh types the synthetic points cycle through
+// -mesh <file> <scale>: add a mesh type (after models/cube.dae), points with a mesh channel past the last type use the first
+// -gridbench: log the build, update and query times of the spatial index on random points instead of rendering
+int main(const int argc, const char *argv[])
+{
+    std::string recordPath;
+    int gridSize = 32;
+    float streamRate = 0.0f;
+    StreamRenderMode renderMode = STREAM_RENDER_AUTO;
+    int meshTypes = 1;
+    for (int i = 0; i < argc; i++) {
+        VulkanExample::args.push_back(argv[i]);
+        std::string arg(argv[i]);
+        if ((arg == "-stream") && (i + 1 < argc)) {
+            recordPath = argv[i + 1];
+        }
+        if ((arg == "-points") && (i + 1 < argc)) {
+            gridSize = atoi(argv[i + 1]);
+        }
+        if ((arg == "-streamrate") && (i + 1 < argc)) {
+            streamRate = (float)atof(argv[i + 1]);
+        }
+        if ((arg == "-render") && (i + 1 < argc)) {
+            std::string mode(argv[i + 1]);
+            renderMode = (mode == "mesh") ? STREAM_RENDER_MESH : (mode == "impostor") ? STREAM_RENDER_IMPOSTOR : STREAM_RENDER_AUTO;
+        }
+        if ((arg == "-meshtypes") && (i + 1 < argc)) {
+            meshTypes = atoi(argv[i + 1]);
+        }
+        if (arg == "-gridbench") {
+            benchmarkSpatialGrid();
+            return 0;
+        }
+    }
+
+    StreamPlayer player;
+    player.start(recordPath, gridSize > 0 ? gridSize : 1, streamRate, renderMode, meshTypes > 0 ? meshTypes : 1);
+
+    vulkanExample = new VulkanExample();
+    vulkanExample->setFilePath(".");
+
+    // create File
+    initFile();
+    startTimer();
+
+    vulkanExample->initVulkan();
+    vulkanExample->prepare();
+    vulkanExample->renderLoop();
+    delete (vulkanExample);
+
+    // close log file
+    closeFile();
+    stopTimer();
+
+    player.stop();
+    return 0;
+}
+#else
 void android_main(android_app* state)
 {
 
@@ -530,4 +1226,5 @@ void android_main(android_app* state)
     // close tcp server
     stopServer();
 
-}
\ No newline at end of file
+}
+#endif
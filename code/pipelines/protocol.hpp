@@ -7,9 +7,10 @@
 
 #include <string>
 #include <map>
+#include <memory>
 #include <vector>
 #include <algorithm>
-#include <android/log.h>
+#include "TraceTime.hpp"
 
 struct HeaderInfo{
 //        char * typeTags;
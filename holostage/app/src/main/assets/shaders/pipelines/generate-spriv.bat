@@ -5,3 +5,5 @@ glslangvalidator -V wireframe.frag -o wireframe.frag.spv
 glslangvalidator -V toon.vert -o toon.vert.spv
 glslangvalidator -V toon.frag -o toon.frag.spv
 
+glslangvalidator -V impostor.vert -o impostor.vert.spv
+glslangvalidator -V impostor.frag -o impostor.frag.spv
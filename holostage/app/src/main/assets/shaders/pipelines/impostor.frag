@@ -0,0 +1,45 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec3 inViewPos;
+layout (location = 1) flat in vec4 inSphere;
+layout (location = 2) flat in vec3 inColor;
+layout (location = 3) flat in vec3 inLightVec;
+layout (location = 4) flat in vec4 inDepthRows;
+
+layout (location = 0) out vec4 outFragColor;
+// The sphere's surface is never in front of the quad, so early depth testing against the quad stays valid
+layout (depth_greater) out float gl_FragDepth;
+
+void main() 
+{
+	// Ray from the eye (view space origin) through the quad against the sphere
+	vec3 rayDir = normalize(inViewPos);
+	vec3 center = inSphere.xyz;
+	float radius = inSphere.w;
+	float b = dot(rayDir, center);
+	float c = dot(center, center) - radius * radius;
+	float discriminant = b * b - c;
+	if (discriminant < 0.0)
+	{
+		discard;
+	}
+	vec3 hit = rayDir * (b - sqrt(discriminant));
+
+	float clipZ = inDepthRows.x * hit.z + inDepthRows.y;
+	float clipW = inDepthRows.z * hit.z + inDepthRows.w;
+	gl_FragDepth = clipZ / clipW;
+
+	// Same lighting as the phong pipeline, with the mesh's material color
+	vec3 color = vec3(mix(inColor, vec3(dot(vec3(0.2126,0.7152,0.0722), inColor)), 0.65));
+	vec3 ambient = color * vec3(1.0);
+	vec3 N = normalize(hit - center);
+	vec3 L = normalize(inLightVec - hit);
+	vec3 V = normalize(-hit);
+	vec3 R = reflect(-L, N);
+	vec3 diffuse = max(dot(N, L), 0.0) * color;
+	vec3 specular = pow(max(dot(R, V), 0.0), 32.0) * vec3(0.35);
+	outFragColor = vec4(ambient + diffuse * 1.75 + specular, 1.0);
+}
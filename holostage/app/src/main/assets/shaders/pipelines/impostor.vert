@@ -0,0 +1,65 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Sphere impostor: one camera facing quad per instance, no vertex buffer
+// The 4 corners of the strip are generated from gl_VertexIndex
+layout (location = 0) in vec3 inPreviousOffset;
+layout (location = 1) in vec3 inOffset;
+
+layout (binding = 0) uniform UBO 
+{
+	mat4 projection;
+	mat4 model;
+	vec4 lightPos;
+	vec4 positionCenter;
+	vec4 positionExtent;
+} ubo;
+
+// Interpolation factor between the previous (0) and current (1) instance positions, above 1 extrapolates
+// Bounding sphere (center relative to the instance, radius) and color of the mesh type
+layout (push_constant) uniform PushConstants
+{
+	float alpha;
+	layout (offset = 16) vec4 sphere;
+	vec4 color;
+} pushConstants;
+
+// View space position on the quad, the ray from the eye through it is intersected with the sphere
+layout (location = 0) out vec3 outViewPos;
+layout (location = 1) flat out vec4 outSphere;
+layout (location = 2) flat out vec3 outColor;
+layout (location = 3) flat out vec3 outLightVec;
+// Rows of the projection needed for the depth of the sphere's surface (z and w of the clip position)
+layout (location = 4) flat out vec4 outDepthRows;
+
+out gl_PerVertex
+{
+	vec4 gl_Position;
+};
+
+void main() 
+{
+	vec3 position = pushConstants.sphere.xyz + mix(inPreviousOffset, inOffset, pushConstants.alpha);
+	vec3 center = (ubo.model * vec4(position, 1.0)).xyz;
+	float radius = pushConstants.sphere.w;
+
+	// The quad sits on the plane of the sphere's front and covers the sphere's whole silhouette seen from the eye:
+	// the sphere's bounding box projected onto that plane, its back face shrinks by (d - r) / (d + r)
+	float distance = max(abs(center.z), radius * 1.001);
+	float zFront = center.z * (distance - radius) / distance;
+	float backScale = (distance - radius) / (distance + radius);
+	vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1) * 2.0 - 1.0;
+	vec2 edge = center.xy + corner * radius;
+	// Per axis the front edge covers more when it lies on the outer side of the view axis, otherwise the back edge
+	vec2 quad = mix(edge * backScale, edge, step(0.0, corner * edge));
+	vec3 viewPos = vec3(quad, zFront);
+
+	outViewPos = viewPos;
+	outSphere = vec4(center, radius);
+	outColor = pushConstants.color.rgb;
+	outLightVec = mat3(ubo.model) * ubo.lightPos.xyz;
+	outDepthRows = vec4(ubo.projection[2][2], ubo.projection[3][2], ubo.projection[2][3], ubo.projection[3][3]);
+	gl_Position = ubo.projection * vec4(viewPos, 1.0);
+}
@@ -3,18 +3,31 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 
+// Packed vertex layout (see vertexLayout in pipelines.cpp)
+// Position: 16 bit snorm relative to the bounds box, normal: octahedral encoded
 layout (location = 0) in vec3 inPos;
-layout (location = 1) in vec3 inNormal;
+layout (location = 1) in vec2 inNormal;
 layout (location = 2) in vec2 inUV;
 layout (location = 3) in vec3 inColor;
+// Per instance: position of the point in the previous and the current frame from the server
+layout (location = 4) in vec3 inPreviousOffset;
+layout (location = 5) in vec3 inOffset;
 
 layout (binding = 0) uniform UBO 
 {
 	mat4 projection;
 	mat4 model;
 	vec4 lightPos;
+	vec4 positionCenter;
+	vec4 positionExtent;
 } ubo;
 
+// Interpolation factor between the previous (0) and current (1) instance positions, above 1 extrapolates
+layout (push_constant) uniform PushConstants
+{
+	float alpha;
+} pushConstants;
+
 layout (location = 0) out vec3 outNormal;
 layout (location = 1) out vec3 outColor;
 layout (location = 2) out vec2 outUV;
@@ -26,15 +39,27 @@ out gl_PerVertex
 	vec4 gl_Position;
 };
 
+vec3 octDecode(vec2 e)
+{
+	vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+	{
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+}
+
 void main() 
 {
-	outNormal = inNormal;
+	vec3 position = ubo.positionCenter.xyz + inPos * ubo.positionExtent.xyz + mix(inPreviousOffset, inOffset, pushConstants.alpha);
+	vec3 normal = octDecode(inNormal);
+
 	outColor = inColor;
 	outUV = inUV;
-	gl_Position = ubo.projection * ubo.model * vec4(inPos.xyz, 1.0);
+	gl_Position = ubo.projection * ubo.model * vec4(position, 1.0);
 	
-	vec4 pos = ubo.model * vec4(inPos, 1.0);
-	outNormal = mat3(ubo.model) * inNormal;
+	vec4 pos = ubo.model * vec4(position, 1.0);
+	outNormal = mat3(ubo.model) * normal;
 	vec3 lPos = mat3(ubo.model) * ubo.lightPos.xyz;
 	outLightVec = lPos - pos.xyz;
 	outViewVec = -pos.xyz;		